@@ -1,194 +1,245 @@
 #pragma once
 
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
 #include <queue>
+#include <stdexcept>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "commons/queue_set.hpp"
 #include "definitions.hpp"
+#include "stats.hpp"
+#include "subhist.hpp"
+#include "traits.hpp"
 
 namespace polylin {
 
+// Type-erased monitor interface, used to select a monitor at runtime
 template <typename value_type>
-class LinBase {
-  typedef Operation<value_type> oper_t;
+class Monitor {
   typedef History<value_type> hist_t;
 
  public:
-  virtual bool distVal(hist_t& hist) = 0;
-
-  hist_t getSubHist(const hist_t& hist, time_type time) {
-    hist_t subhist;
-    std::unordered_set<value_type> removeOps, allOps;
-    for (const auto& o : hist)
-      if (o.endTime <= time) {
-        subhist.emplace(o);
-        if (o.value != EMPTY_VALUE) {
-          allOps.insert(o.value);
-          if (removes.count(o.method)) removeOps.insert(o.value);
-        }
-      }
+  virtual ~Monitor() = default;
 
-    for (auto o : hist)
-      if (o.startTime < time && time < o.endTime && allOps.count(o.value)) {
-        o.endTime = time + 3;
-        if (removes.count(o.method)) removeOps.insert(o.value);
-        subhist.emplace(std::move(o));
-      }
+  virtual bool distVal(hist_t hist) = 0;
 
-    for (const value_type& value : allOps) {
-      if (!removeOps.count(value))
-        subhist.emplace(*removes.begin(), value, time + 1, time + 2, true);
-    }
-    return subhist;
+  // Sub-histories of `hist` for the incremental search
+  virtual std::unique_ptr<SubHistView<value_type>> getSubHists(
+      hist_t hist) = 0;
+
+  // Checks the sub-history of `view` at `time`
+  virtual bool distValAt(SubHistView<value_type>& view, time_type time) = 0;
+};
+
+// Shared preprocessing of monitors, specialized on the method traits of the
+// monitored data type
+template <typename value_type, typename traits>
+class LinBase : public Monitor<value_type> {
+  typedef Operation<value_type> oper_t;
+  typedef History<value_type> hist_t;
+
+ public:
+  std::unique_ptr<SubHistView<value_type>> getSubHists(hist_t hist) {
+    return std::make_unique<PrefixView<value_type, traits>>(std::move(hist));
+  }
+
+  // The view derives the sorted events and value ids of the sub-history
+  // along, which spares its preprocessing a sort and hashing
+  bool distValAt(SubHistView<value_type>& view, time_type time) {
+    struct reset_index {
+      std::optional<history_index>& index;
+      ~reset_index() { index.reset(); }
+    } reset{nextIndex};
+    nextIndex.emplace();
+    hist_t subhist = view.at(time, &*nextIndex);
+    return this->distVal(std::move(subhist));
   }
 
  protected:
-  LinBase(const std::vector<Method>&& adds, const std::vector<Method>&& removes)
-      : adds(adds.begin(), adds.end()),
-        removes(removes.begin(), removes.end()) {}
+  static constexpr id_type NO_OP = std::numeric_limits<id_type>::max();
 
-  bool preprocess(hist_t& hist) const {
-    return extend(hist) && tune(hist) && removeEmpty(hist);
+  // Throws if `hist` has more than `maxSize` operations, rather than let
+  // their indices wrap
+  static void checkSize(const hist_t& hist, size_t maxSize = NO_OP) {
+    if (hist.size() > maxSize)
+      throw std::length_error("History too large: " +
+                              std::to_string(hist.size()) + " operations");
   }
 
-  // Extend chooses the first remove method as default remove method, O(n)
-  bool extend(hist_t& hist) const {
-    time_type maxTime = MIN_TIME;
-    std::unordered_set<value_type> addOps, removeOps, allOps;
+  // Hands the value ids of the preprocessed history to `valueIndex` if given
+  bool preprocess(hist_t& hist, history_index* valueIndex = nullptr) {
+    checkSize(hist);
+    validate(hist);
+    history_index index =
+        nextIndex ? std::move(*nextIndex) : indexValues(hist);
+    nextIndex.reset();
+    const id_type size = hist.size();
+    if (!extend(hist, index)) return false;
+    checkSize(hist);
+    if (index.events.empty())
+      index.events = getEvents(hist);
+    else
+      appendEvents(hist, size, index.events);
+    if (!tune(hist, index) || !removeEmpty(hist, index)) return false;
+    if (valueIndex) *valueIndex = std::move(index);
+    return true;
+  }
+
+  // Rejects methods not declared by `traits`, and empty results of methods
+  // that cannot observe an empty container
+  void validate(const hist_t& hist) const {
     for (const oper_t& o : hist) {
+      if (!traits::supports(o.method))
+        throw std::invalid_argument("Unsupported method: " +
+                                    std::string(methodNames[o.method]));
+      if (o.value == EMPTY_VALUE && !traits::canBeEmpty(o.method))
+        throw std::invalid_argument("Method cannot return empty: " +
+                                    std::string(methodNames[o.method]));
+    }
+  }
+
+  // Extend fabricates removes with the default remove method of `traits`, O(n)
+  bool extend(hist_t& hist, history_index& index) const {
+    POLYLIN_STAT_SCOPE(STAT_EXTEND);
+    time_type maxTime = MIN_TIME;
+    // Successful adds and removes of every value, and one of its operations
+    std::vector<uint8_t> adds(index.numValues), removes(index.numValues);
+    std::vector<id_type> opOf(index.numValues, NO_OP);
+    for (id_type i = 0; i < hist.size(); ++i) {
+      const oper_t& o = hist[i];
+      // Fabricated removes follow every operation, empty ones included
+      maxTime = std::max(maxTime, o.endTime);
       if (o.value == EMPTY_VALUE || o.retVal == false) continue;
 
-      allOps.insert(o.value);
-      if (adds.count(o.method) && !addOps.insert(o.value).second)
+      const uint32_t v = index.valueOf[i];
+      opOf[v] = i;
+      if (traits::isAdd(o.method) && adds[v]++)
         return false;
-      else if (removes.count(o.method) && !removeOps.insert(o.value).second)
+      else if (traits::isRemove(o.method) && removes[v]++)
         return false;
-      maxTime = std::max(maxTime, o.endTime);
     }
-    for (const value_type& value : allOps) {
-      if (!addOps.count(value)) return false;
-      if (!removeOps.count(value))
-        hist.emplace(*removes.begin(), value, maxTime + 1, maxTime + 2, true);
+    for (uint32_t v = 0; v < index.numValues; ++v) {
+      if (opOf[v] == NO_OP) continue;
+      if (!adds[v]) return false;
+      if (!removes[v]) {
+        const value_type value = hist[opOf[v]].value;
+        hist.emplace_back(traits::defaultRemoveMethod, value, maxTime + 1,
+                          maxTime + 2);
+        index.valueOf.push_back(v);
+      }
     }
     return true;
   };
 
+  // Appends the events of the removes fabricated by `extend` from `size` on,
+  // which follow all other events
+  static void appendEvents(const hist_t& hist, id_type size,
+                           std::vector<event>& events) {
+    for (id_type i = size; i < hist.size(); ++i)
+      events.push_back({hist[i].startTime, true, i});
+    for (id_type i = size; i < hist.size(); ++i)
+      events.push_back({hist[i].endTime, false, i});
+  }
+
   // All timings in simplified history are distinct
-  bool tune(hist_t& hist) const {
-    // Sort events
-    std::vector<std::tuple<time_type, bool, oper_t>> events;
-    for (const oper_t& o : hist) {
-      events.emplace_back(o.startTime, true, o);
-      events.emplace_back(o.endTime, false, o);
-    }
-    hist.clear();
-    std::sort(events.begin(), events.end());
+  bool tune(hist_t& hist, const history_index& index) const {
+    POLYLIN_STAT_SCOPE(STAT_TUNE);
+    std::vector<bool> ended(hist.size());
 
-    std::unordered_map<value_type, oper_t> addOps, rmOps;
-    std::unordered_map<value_type, queue_set<oper_t>> otherOps;
+    // Running operations by value id
+    std::vector<id_type> addOps(index.numValues, NO_OP),
+        rmOps(index.numValues, NO_OP);
+    std::unordered_map<uint32_t, queue_set<id_type>> otherOps;
 
+    // Operations are retimed in place, `ended` marks responded operations
     time_type time = MIN_TIME;
-    for (const auto& [_, isInv, o] : events) {
+    auto endOp = [&](id_type id) {
+      hist[id].endTime = ++time;
+      ended[id] = true;
+    };
+
+    for (const auto& [_, isInv, id] : index.events) {
+      const oper_t& o = hist[id];
+      const uint32_t v = index.valueOf[id];
       if (isInv) {
         // Skip checks for empty values
         if (o.value == EMPTY_VALUE) {
-          oper_t op{o};
-          op.startTime = ++time;
-          otherOps[o.value].enqueue(std::move(op));
+          hist[id].startTime = ++time;
           continue;
         }
 
-        if (adds.count(o.method)) {
+        if (traits::isAdd(o.method)) {
           // Start add operation
-          oper_t addOp{o};
-          addOp.startTime = ++time;
-          addOps.emplace(o.value, std::move(addOp));
+          hist[id].startTime = ++time;
+          addOps[v] = id;
           // Increment ongoing other operations start time
-          queue_set<oper_t>& oldQueue = otherOps[o.value];
-          queue_set<oper_t> newQueue;
-          while (!oldQueue.empty()) {
-            oper_t op{oldQueue.dequeue()};
-            op.startTime = ++time;
-            newQueue.enqueue(std::move(op));
+          if (auto iter = otherOps.find(v); iter != otherOps.end()) {
+            queue_set<id_type>& oldQueue = iter->second;
+            queue_set<id_type> newQueue;
+            while (!oldQueue.empty()) {
+              id_type opId = oldQueue.dequeue();
+              hist[opId].startTime = ++time;
+              newQueue.enqueue(std::move(opId));
+            }
+            std::swap(oldQueue, newQueue);
           }
-          std::swap(oldQueue, newQueue);
           // Increment ongoing remove operation start time
-          if (rmOps.count(o.value)) {
-            oper_t rmOp{rmOps.at(o.value)};
-            rmOp.startTime = ++time;
-            rmOps.erase(o.value);
-            rmOps.emplace(o.value, std::move(rmOp));
-          }
-        } else if (removes.count(o.method)) {
+          if (rmOps[v] != NO_OP) hist[rmOps[v]].startTime = ++time;
+        } else if (traits::isRemove(o.method)) {
           // Start remove operation
-          oper_t rmOp{o};
-          rmOp.startTime = ++time;
-          rmOps.emplace(o.value, std::move(rmOp));
+          hist[id].startTime = ++time;
+          rmOps[v] = id;
         } else {
           // Enqueue operation
-          oper_t op{o};
-          op.startTime = ++time;
-          otherOps[o.value].enqueue(std::move(op));
+          hist[id].startTime = ++time;
+          otherOps[v].enqueue(id_type{id});
           // Increment ongoing remove operation start time
-          if (rmOps.count(o.value)) {
-            oper_t rmOp{rmOps.at(o.value)};
+          if (rmOps[v] != NO_OP) {
+            id_type rmId = rmOps[v];
             // Remove operation responded
-            if (hist.count(rmOp)) return false;
-            rmOp.startTime = ++time;
-            rmOps.erase(o.value);
-            rmOps.emplace(o.value, std::move(rmOp));
+            if (ended[rmId]) return false;
+            hist[rmId].startTime = ++time;
           }
         }
       } else {
         // Skip checks for empty values
         if (o.value == EMPTY_VALUE) {
-          oper_t op{otherOps[o.value].remove(o)};
-          op.endTime = ++time;
-          hist.emplace(std::move(op));
+          endOp(id);
           continue;
         }
 
-        if (adds.count(o.method)) {
+        if (traits::isAdd(o.method)) {
           // End add operation
-          oper_t addOp{addOps.at(o.value)};
-          addOp.endTime = ++time;
-          hist.emplace(std::move(addOp));
-        } else if (removes.count(o.method)) {
+          if (!ended[id]) endOp(id);
+        } else if (traits::isRemove(o.method)) {
           // Add operation not yet invoked
-          if (!addOps.count(o.value)) return false;
+          if (addOps[v] == NO_OP) return false;
           // End any ongoing add operation
-          oper_t addOp{addOps.at(o.value)};
-          if (!hist.count(addOp)) {
-            addOp.endTime = ++time;
-            hist.emplace(std::move(addOp));
-          }
+          id_type addId = addOps[v];
+          if (!ended[addId]) endOp(addId);
           // End any running other operations
-          queue_set<oper_t>& opQueue = otherOps[o.value];
-          while (!opQueue.empty()) {
-            oper_t op{opQueue.dequeue()};
-            op.endTime = ++time;
-            hist.emplace(std::move(op));
+          if (auto iter = otherOps.find(v); iter != otherOps.end()) {
+            while (!iter->second.empty()) endOp(iter->second.dequeue());
+            otherOps.erase(iter);
           }
           // End remove operation
-          oper_t rmOp{rmOps.at(o.value)};
-          rmOp.endTime = ++time;
-          hist.emplace(std::move(rmOp));
+          endOp(rmOps[v]);
         } else {
           // Add operation not yet invoked
-          if (!addOps.count(o.value)) return false;
+          if (addOps[v] == NO_OP) return false;
           // End any ongoing add operation
-          oper_t addOp{addOps.at(o.value)};
-          if (!hist.count(addOp)) {
-            addOp.endTime = ++time;
-            hist.emplace(std::move(addOp));
-          }
+          id_type addId = addOps[v];
+          if (!ended[addId]) endOp(addId);
           // End operation
-          if (otherOps[o.value].contains(o)) {
-            oper_t op{otherOps[o.value].remove(o)};
-            op.endTime = ++time;
-            hist.emplace(std::move(op));
+          auto iter = otherOps.find(v);
+          if (iter != otherOps.end() && iter->second.contains(id)) {
+            iter->second.remove(id);
+            endOp(id);
           }
         }
       }
@@ -196,49 +247,81 @@ class LinBase {
     return true;
   }
 
-  // Only works on histories simplifed via `tune(hist)`
+  // Only works on histories simplifed via `tune(hist)`, whose times are
+  // distinct and compact. Every value is then added and removed once, and is
+  // critical from the response of its add to the invocation of its remove.
+  // An empty operation must observe a moment without critical values, which
+  // a single pass over times finds through the last such moment.
   // Note that empty operations can be of any method,
-  // the only requirement being `value == EMPTY_VALUE`
-  bool removeEmpty(hist_t& hist) const {
-    std::vector<std::tuple<time_type, bool, oper_t>> events;
-    for (const oper_t& o : hist) {
-      events.emplace_back(o.startTime, true, o);
-      events.emplace_back(o.endTime, false, o);
-    }
-    std::sort(events.begin(), events.end());
+  // the only requirement being `value == EMPTY_VALUE`. The value ids of
+  // `index` are kept in step with the operations left.
+  bool removeEmpty(hist_t& hist, history_index& index) const {
+    POLYLIN_STAT_SCOPE(STAT_REMOVE_EMPTY);
+    if (hist.empty()) return true;
 
-    std::unordered_set<id_type> runningEmptyOp;
-    std::unordered_set<value_type> critVal, endedVal;
+    time_type minTime = hist[0].startTime, maxTime = hist[0].endTime;
+    std::vector<id_type> addOf(index.numValues, NO_OP);
+    for (id_type i = 0; i < hist.size(); ++i) {
+      const oper_t& o = hist[i];
+      minTime = std::min(minTime, o.startTime);
+      maxTime = std::max(maxTime, o.endTime);
+      if (o.value != EMPTY_VALUE && traits::isAdd(o.method))
+        addOf[index.valueOf[i]] = i;
+    }
 
-    for (const auto& [_, isInv, op] : events) {
-      if (op.value != EMPTY_VALUE) {
-        if (isInv) {
-          if (removes.count(op.method)) {
-            critVal.erase(op.value);
-            endedVal.insert(op.value);
-          }
-        } else {
-          if (adds.count(op.method) && !endedVal.count(op.value))
-            critVal.insert(op.value);
-        }
-      } else {
-        if (isInv)
-          runningEmptyOp.insert(op.id);
-        else if (runningEmptyOp.count(op.id))
-          return false;
-        else
-          hist.erase(op);
+    // Change in the number of critical values at every time
+    std::vector<int8_t> delta(maxTime - minTime + 1, 0);
+    for (id_type i = 0; i < hist.size(); ++i) {
+      const oper_t& o = hist[i];
+      if (o.value == EMPTY_VALUE || !traits::isRemove(o.method)) continue;
+      const oper_t& add = hist[addOf[index.valueOf[i]]];
+      if (add.endTime < o.startTime) {
+        ++delta[add.endTime - minTime];
+        --delta[o.startTime - minTime];
       }
-
-      if (critVal.empty()) runningEmptyOp.clear();
     }
 
-    return true;
+    // Compact times fit 32 bits unless the history is huge
+    if (delta.size() < std::numeric_limits<uint32_t>::max())
+      return removeEmptyOps<uint32_t>(hist, index.valueOf, delta, minTime);
+    return removeEmptyOps<uint64_t>(hist, index.valueOf, delta, minTime);
   };
 
  private:
-  const std::unordered_set<Method> adds;
-  const std::unordered_set<Method> removes;
+  // Drops the empty operations of `hist` and their entries of `valueOf`,
+  // failing unless each overlaps a moment without critical values, given the
+  // changes `delta` in their number from `minTime` on
+  template <typename moment_type>
+  static bool removeEmptyOps(hist_t& hist, std::vector<uint32_t>& valueOf,
+                             const std::vector<int8_t>& delta,
+                             time_type minTime) {
+    // Last moment up to every time without critical values, offset by one so
+    // that 0 stands for none
+    std::vector<moment_type> lastFree(delta.size());
+    int64_t critCount = 0;
+    for (size_t t = 0, last = 0; t < delta.size(); ++t) {
+      critCount += delta[t];
+      if (critCount == 0) last = t + 1;
+      lastFree[t] = last;
+    }
+
+    id_type size = 0;
+    for (id_type i = 0; i < hist.size(); ++i) {
+      const oper_t& o = hist[i];
+      if (o.value != EMPTY_VALUE) {
+        valueOf[size] = valueOf[i];
+        hist[size++] = o;
+      } else if (lastFree[o.endTime - minTime - 1] <= o.startTime - minTime) {
+        return false;
+      }
+    }
+    hist.resize(size);
+    valueOf.resize(size);
+    return true;
+  }
+
+  // Index of the next history to preprocess, given by a sub-history view
+  std::optional<history_index> nextIndex;
 };
 
-}  // namespace polylin
\ No newline at end of file
+}  // namespace polylin
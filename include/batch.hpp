@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cache.hpp"
+#include "check.hpp"
+#include "ingest.hpp"
+#include "reader.hpp"
+
+namespace polylin {
+
+struct batch_params {
+  size_t numThreads;
+  // Number of file buffers, bounding the files loaded ahead of the workers
+  size_t prefetch;
+  bool incremental;
+  bool timed;
+  io_method io = io_method::automatic;
+  // Results reused and stored, if any
+  ResultCache* cache = nullptr;
+};
+
+// History files listed by `path`, either the regular files of a directory in
+// name order or the lines of a list file
+inline std::vector<std::string> listHistories(const std::string& path) {
+  namespace fs = std::filesystem;
+  std::vector<std::string> files;
+  if (fs::is_directory(path)) {
+    for (const auto& entry : fs::directory_iterator(path))
+      if (entry.is_regular_file()) files.push_back(entry.path().string());
+    std::sort(files.begin(), files.end());
+    return files;
+  }
+
+  std::istringstream list{readFile(path)};
+  std::string line;
+  while (std::getline(list, line)) {
+    line = trim(line);
+    if (!line.empty() && line[0] != '#') files.push_back(line);
+  }
+  return files;
+}
+
+// Checks `files` on a pool of workers fed by a loader thread, which keeps a
+// read in flight for every free file buffer, handing files to the workers as
+// they complete. Workers reuse their monitors, and file buffers are recycled
+// between the loader and the workers. Results are written to `out` in input
+// order as tab-separated lines of path, result, violation time if
+// incremental and seconds of the full check if timed, which leave out the
+// search for a violation. Files that cannot be checked get `error` as result
+// and their reason on `err`. Files whose result is cached skip parsing and
+// checking.
+template <typename value_type>
+void runBatch(const std::vector<std::string>& files,
+              const batch_params& params, std::ostream& out,
+              std::ostream& err) {
+  struct job {
+    size_t index;
+    std::string text;
+    std::string error;
+  };
+  struct row {
+    std::string line;
+    std::string error;
+  };
+
+  std::mutex mutex;
+  std::condition_variable loaderCv, workerCv, writerCv;
+  std::vector<std::string> freeBuffers(std::max<size_t>(params.prefetch, 1));
+  std::deque<job> loaded;
+  bool loading = true;
+  std::vector<std::optional<row>> rows(files.size());
+
+  std::unique_ptr<FileLoader> fileLoader = makeFileLoader(params.io);
+  auto load = [&]() {
+    // Jobs whose files are being read, by index
+    std::unordered_map<size_t, job> reading;
+    size_t next = 0;
+    while (next < files.size() || fileLoader->pending()) {
+      // Reads into every free buffer, waiting for one only if none is read
+      for (; next < files.size(); ++next) {
+        std::unique_lock lock{mutex};
+        if (freeBuffers.empty() && fileLoader->pending()) break;
+        loaderCv.wait(lock, [&]() { return !freeBuffers.empty(); });
+        job& j = reading[next] = {next, std::move(freeBuffers.back()), {}};
+        freeBuffers.pop_back();
+        lock.unlock();
+        fileLoader->submit(next, files[next], j.text);
+      }
+
+      loaded_file file = fileLoader->wait();
+      auto iter = reading.find(file.tag);
+      job j = std::move(iter->second);
+      reading.erase(iter);
+      j.error = std::move(file.error);
+      {
+        std::scoped_lock lock{mutex};
+        loaded.push_back(std::move(j));
+      }
+      workerCv.notify_one();
+    }
+    {
+      std::scoped_lock lock{mutex};
+      loading = false;
+    }
+    workerCv.notify_all();
+  };
+
+  auto work = [&]() {
+    std::unordered_map<std::string, std::unique_ptr<Monitor<value_type>>>
+        monitors;
+    // Text of the gzip-compressed file being checked
+    std::string inflated;
+    for (;;) {
+      job j;
+      {
+        std::unique_lock lock{mutex};
+        workerCv.wait(lock, [&]() { return !loaded.empty() || !loading; });
+        if (loaded.empty()) return;
+        j = std::move(loaded.front());
+        loaded.pop_front();
+      }
+
+      row r{files[j.index], std::move(j.error)};
+      History<value_type> hist;
+      std::unique_ptr<Monitor<value_type>>* monitor = nullptr;
+      std::optional<cached_result> checked;
+      content_key key{};
+      if (r.error.empty() && params.cache) {
+        try {
+          key = contentKey(j.text);
+          checked = params.cache->find(key, params.incremental);
+        } catch (const std::exception& e) {
+          r.error = e.what();
+        }
+      }
+      if (r.error.empty() && !checked) {
+        try {
+          std::string_view text = decompressed(j.text, inflated);
+          std::string type = parseHistType(text);
+          monitor = &monitors[type];
+          if (!*monitor) *monitor = getMonitor<value_type>(type);
+          hist.reserve(std::count(text.begin(), text.end(), '\n') + 1);
+          parseHistory(text, hasRetVal(type), hist);
+        } catch (const std::exception& e) {
+          r.error = e.what();
+        }
+      }
+      {
+        std::scoped_lock lock{mutex};
+        freeBuffers.push_back(std::move(j.text));
+      }
+      loaderCv.notify_one();
+
+      if (r.error.empty() && !checked) {
+        try {
+          double secs;
+          check_result result = checkHistory(**monitor, std::move(hist),
+                                             params.incremental, secs);
+          checked = {result, secs};
+          if (params.cache)
+            params.cache->store(key, params.incremental, *checked);
+        } catch (const std::exception& e) {
+          r.error = e.what();
+        }
+      }
+      std::ostringstream fields;
+      if (checked) {
+        fields << '\t' << checked->result.linearizable;
+        if (params.incremental) {
+          fields << '\t';
+          if (checked->result.linearizable)
+            fields << -1;
+          else
+            fields << checked->result.violationTime;
+        }
+        if (params.timed) fields << '\t' << checked->seconds;
+      }
+      if (!r.error.empty()) {
+        fields.str("");
+        fields << "\terror";
+        if (params.incremental) fields << "\t-";
+        if (params.timed) fields << "\t-";
+      }
+      r.line += fields.str();
+
+      {
+        std::scoped_lock lock{mutex};
+        rows[j.index] = std::move(r);
+      }
+      writerCv.notify_one();
+    }
+  };
+
+  std::thread loader{load};
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < std::max<size_t>(params.numThreads, 1); ++i)
+    workers.emplace_back(work);
+
+  out << "file\tresult";
+  if (params.incremental) out << "\tviolation_time";
+  if (params.timed) out << "\tseconds";
+  out << '\n';
+  for (size_t i = 0; i < files.size(); ++i) {
+    row r;
+    {
+      std::unique_lock lock{mutex};
+      writerCv.wait(lock, [&]() { return rows[i].has_value(); });
+      r = std::move(*rows[i]);
+      rows[i].reset();
+    }
+    out << r.line << '\n';
+    if (!r.error.empty()) err << files[i] << ": " << r.error << '\n';
+  }
+  out.flush();
+
+  loader.join();
+  for (std::thread& worker : workers) worker.join();
+}
+
+}  // namespace polylin
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include "check.hpp"
+#include "reader.hpp"
+#include "util.hpp"
+
+namespace polylin {
+
+// Result of a check kept by a `ResultCache`, with the seconds reported
+struct cached_result {
+  check_result result;
+  double seconds;
+};
+
+// Results of checks on disk, one small file per history content hash and
+// mode, so that checking a byte-identical history again skips parsing and
+// checking. Entries also hold the length and data type of the history,
+// which must match too, so that a hash collision is a miss rather than the
+// result of another history. Entries are written to a temporary file and
+// renamed, so that concurrent checks may share the directory. The cache is
+// best effort: entries that cannot be read or written are misses.
+class ResultCache {
+  // Bumped whenever results of a history, or their seconds, may change
+  static constexpr int VERSION = 3;
+
+ public:
+  explicit ResultCache(std::string dir) : dir(std::move(dir)) {
+    std::error_code ec;
+    std::filesystem::create_directories(this->dir, ec);
+  }
+
+  // Result of checking the history of `key`, incrementally if
+  // `incremental`. Incremental results also answer full checks.
+  std::optional<cached_result> find(const content_key& key,
+                                    bool incremental) const {
+    if (std::optional<cached_result> hit = read(path(key.hash, true), key))
+      return hit;
+    if (incremental) return std::nullopt;
+    return read(path(key.hash, false), key);
+  }
+
+  void store(const content_key& key, bool incremental,
+             const cached_result& entry) {
+    const std::string target = path(key.hash, incremental);
+    std::ostringstream tmp;
+    tmp << target << ".tmp." << getpid() << '.'
+        << std::hash<std::thread::id>()(std::this_thread::get_id());
+    bool written;
+    {
+      std::ofstream out(tmp.str());
+      out << "polylin-cache " << VERSION << ' ' << sizeof(DEFAULT_VALUE_TYPE)
+          << ' ' << key.size << ' ' << entry.result.linearizable << ' '
+          << entry.result.violationTime << ' ' << entry.seconds << ' '
+          << key.type << std::endl;
+      written = bool(out);
+    }
+    std::error_code ec;
+    if (written) std::filesystem::rename(tmp.str(), target, ec);
+    if (!written || ec) std::filesystem::remove(tmp.str(), ec);
+  }
+
+ private:
+  std::string path(uint64_t hash, bool incremental) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.%c",
+                  static_cast<unsigned long long>(hash),
+                  incremental ? 'i' : 'c');
+    return dir + name;
+  }
+
+  // Entry at `path` if it was stored for the history of `key`
+  static std::optional<cached_result> read(const std::string& path,
+                                           const content_key& key) {
+    std::ifstream in(path);
+    std::string magic, type;
+    int version;
+    size_t valueSize;
+    uint64_t size;
+    cached_result entry;
+    // the type ends the line, as it may hold spaces
+    if (!(in >> magic >> version >> valueSize >> size >>
+          entry.result.linearizable >> entry.result.violationTime >>
+          entry.seconds) ||
+        !std::getline(in >> std::ws, type) || magic != "polylin-cache" ||
+        version != VERSION || valueSize != sizeof(DEFAULT_VALUE_TYPE) ||
+        size != key.size || type != key.type)
+      return std::nullopt;
+    return entry;
+  }
+
+  const std::string dir;
+};
+
+}  // namespace polylin
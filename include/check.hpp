@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "deque.hpp"
+#include "priorityqueue.hpp"
+#include "queue.hpp"
+#include "set.hpp"
+#include "stack.hpp"
+
+namespace polylin {
+
+template <typename value_type>
+std::unique_ptr<Monitor<value_type>> getMonitor(const std::string& type) {
+  if (type == "stack") return std::make_unique<StackLin<value_type>>();
+  if (type == "queue") return std::make_unique<QueueLin<value_type>>();
+  if (type == "pqueue") return std::make_unique<PriorityQueueLin<value_type>>();
+  if (type == "set") return std::make_unique<SetLin<value_type>>();
+  if (type == "deque") return std::make_unique<DequeLin<value_type>>();
+  throw std::invalid_argument("Unknown data type");
+}
+
+// Distinct invocation and response times of `hist`, in increasing order
+template <typename value_type>
+std::vector<time_type> getTimes(const History<value_type>& hist) {
+  std::vector<time_type> times;
+  times.reserve(2 * hist.size());
+  for (const auto& o : hist) {
+    times.push_back(o.startTime);
+    times.push_back(o.endTime);
+  }
+  std::sort(times.begin(), times.end());
+  times.erase(std::unique(times.begin(), times.end()), times.end());
+  return times;
+}
+
+// Bisects the sub-histories of `hist`, a non-linearizable history, for the
+// earliest time a violation is observed
+template <typename value_type>
+time_type findViolation(Monitor<value_type>& monitor,
+                        History<value_type> hist) {
+  POLYLIN_STAT_SCOPE(STAT_BISECT);
+  std::vector<time_type> times = getTimes(hist);
+  std::unique_ptr<SubHistView<value_type>> subHists =
+      monitor.getSubHists(std::move(hist));
+  size_t low = 0, high = times.size() - 1;
+  while (low < high) {
+    POLYLIN_STAT_COUNT(STAT_BISECT_PROBES, 1);
+    size_t mid = low + (high - low) / 2;
+    if (monitor.distValAt(*subHists, times[mid]))
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return times[low];
+}
+
+// Checks `hist`, then bisects sub-histories for the earliest violation if
+// `incremental`. `secs` is set to the seconds of the full check, in whole
+// microseconds as printed by `polylin`, leaving out the search.
+template <typename value_type>
+check_result checkHistory(Monitor<value_type>& monitor,
+                          History<value_type> hist, bool incremental,
+                          double& secs) {
+  typedef std::chrono::high_resolution_clock hr_clock;
+  hr_clock::time_point start = hr_clock::now();
+  check_result result{true, 0};
+  {
+    POLYLIN_STAT_SCOPE(STAT_CHECK);
+    // Preprocessing rewrites the history it checks, so the incremental
+    // check runs on a copy and keeps `hist` for the search
+    result.linearizable = incremental ? monitor.distVal(hist)
+                                      : monitor.distVal(std::move(hist));
+  }
+  secs = std::chrono::duration_cast<std::chrono::microseconds>(
+             hr_clock::now() - start)
+             .count() /
+         1e6;
+  if (!result.linearizable && incremental)
+    result.violationTime = findViolation(monitor, std::move(hist));
+  return result;
+}
+
+template <typename value_type>
+check_result checkHistory(Monitor<value_type>& monitor,
+                          History<value_type> hist, bool incremental) {
+  double secs;
+  return checkHistory(monitor, std::move(hist), incremental, secs);
+}
+
+// Output of `polylin` for `result`, with the violation time if
+// `incremental` and `secs` if `timed`
+inline std::string formatResult(const check_result& result, bool incremental,
+                                bool timed, double secs) {
+  std::ostringstream out;
+  out << result.linearizable;
+  if (incremental)
+    out << ' '
+        << (result.linearizable ? "-1" : std::to_string(result.violationTime));
+  if (timed) out << ' ' << secs;
+  return out.str();
+}
+
+}  // namespace polylin
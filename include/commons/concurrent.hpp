@@ -0,0 +1,247 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Concurrent reference containers the history generators run against. Nodes
+// are never recycled, which rules out ABA in the lock-free ones without any
+// memory reclamation, at the cost of one node per push. All methods are
+// linearizable.
+namespace polylin {
+
+inline void cpuRelax() {
+#if defined(__x86_64__)
+  _mm_pause();
+#endif
+}
+
+// Test-and-test-and-set lock for containers without a simple lock-free
+// counterpart, cheaper than a mutex for their short critical sections
+class spin_lock {
+ public:
+  void lock() {
+    while (locked.exchange(true, std::memory_order_acquire))
+      while (locked.load(std::memory_order_relaxed)) cpuRelax();
+  }
+
+  void unlock() { locked.store(false, std::memory_order_release); }
+
+ private:
+  std::atomic<bool> locked{false};
+};
+
+// Per-thread pools of nodes, each allocated up front for a known number of
+// pushes by its thread
+template <typename node>
+class node_pools {
+ public:
+  node_pools(size_t numThreads, size_t perThread) : pools(numThreads) {
+    for (pool& p : pools) p.nodes = std::make_unique<node[]>(perThread);
+  }
+
+  node* alloc(size_t tid) {
+    pool& p = pools[tid];
+    return &p.nodes[p.next++];
+  }
+
+ private:
+  struct alignas(64) pool {
+    std::unique_ptr<node[]> nodes;
+    size_t next = 0;
+  };
+  std::vector<pool> pools;
+};
+
+// Treiber stack
+template <typename T>
+class treiber_stack {
+  struct node {
+    T value;
+    node* next;
+  };
+
+ public:
+  treiber_stack(size_t numThreads, size_t perThread)
+      : nodes(numThreads, perThread) {}
+
+  void push(size_t tid, const T& value) {
+    node* n = nodes.alloc(tid);
+    n->value = value;
+    n->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(n->next, n, std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+    }
+  }
+
+  bool pop(T& value) {
+    node* n = head.load(std::memory_order_acquire);
+    while (n && !head.compare_exchange_weak(n, n->next,
+                                            std::memory_order_acquire)) {
+    }
+    if (!n) return false;
+    value = n->value;
+    return true;
+  }
+
+  bool peek(T& value) const {
+    node* n = head.load(std::memory_order_acquire);
+    if (!n) return false;
+    value = n->value;
+    return true;
+  }
+
+ private:
+  node_pools<node> nodes;
+  alignas(64) std::atomic<node*> head{nullptr};
+};
+
+// Michael-Scott queue
+template <typename T>
+class ms_queue {
+  struct node {
+    T value;
+    std::atomic<node*> next{nullptr};
+  };
+
+ public:
+  ms_queue(size_t numThreads, size_t perThread)
+      : nodes(numThreads, perThread), head(&dummy), tail(&dummy) {}
+
+  void enqueue(size_t tid, const T& value) {
+    node* n = nodes.alloc(tid);
+    n->value = value;
+    for (;;) {
+      node* last = tail.load(std::memory_order_acquire);
+      node* next = last->next.load(std::memory_order_acquire);
+      if (next) {
+        tail.compare_exchange_weak(last, next, std::memory_order_release);
+        continue;
+      }
+      if (last->next.compare_exchange_weak(next, n,
+                                           std::memory_order_release)) {
+        tail.compare_exchange_strong(last, n, std::memory_order_release);
+        return;
+      }
+    }
+  }
+
+  bool dequeue(T& value) {
+    for (;;) {
+      node* first = head.load(std::memory_order_acquire);
+      node* last = tail.load(std::memory_order_acquire);
+      node* next = first->next.load(std::memory_order_acquire);
+      if (!next) return false;
+      if (first == last) {
+        tail.compare_exchange_weak(last, next, std::memory_order_release);
+        continue;
+      }
+      // nodes are never freed, so `next` stays readable after losing
+      value = next->value;
+      if (head.compare_exchange_weak(first, next, std::memory_order_acq_rel))
+        return true;
+    }
+  }
+
+ private:
+  node_pools<node> nodes;
+  node dummy;
+  alignas(64) std::atomic<node*> head;
+  alignas(64) std::atomic<node*> tail;
+};
+
+// Set over the keys `[0, numKeys)`, a flag per key
+class flag_set {
+ public:
+  flag_set(size_t numKeys) : flags(numKeys) {}
+
+  bool insert(size_t key) {
+    return !flags[key].exchange(true, std::memory_order_acq_rel);
+  }
+
+  bool remove(size_t key) {
+    return flags[key].exchange(false, std::memory_order_acq_rel);
+  }
+
+  bool contains(size_t key) const {
+    return flags[key].load(std::memory_order_acquire);
+  }
+
+ private:
+  std::vector<std::atomic<bool>> flags;
+};
+
+// Max priority queue guarded by a spin lock
+template <typename T>
+class locked_pqueue {
+ public:
+  void insert(const T& value) {
+    std::scoped_lock guard{lock};
+    heap.push(value);
+  }
+
+  bool poll(T& value) {
+    std::scoped_lock guard{lock};
+    if (heap.empty()) return false;
+    value = heap.top();
+    heap.pop();
+    return true;
+  }
+
+  bool peek(T& value) {
+    std::scoped_lock guard{lock};
+    if (heap.empty()) return false;
+    value = heap.top();
+    return true;
+  }
+
+ private:
+  spin_lock lock;
+  std::priority_queue<T> heap;
+};
+
+// Deque guarded by a spin lock
+template <typename T>
+class locked_deque {
+ public:
+  void push(bool front, const T& value) {
+    std::scoped_lock guard{lock};
+    if (front)
+      items.push_front(value);
+    else
+      items.push_back(value);
+  }
+
+  bool pop(bool front, T& value) {
+    std::scoped_lock guard{lock};
+    if (items.empty()) return false;
+    if (front) {
+      value = items.front();
+      items.pop_front();
+    } else {
+      value = items.back();
+      items.pop_back();
+    }
+    return true;
+  }
+
+  bool peek(bool front, T& value) {
+    std::scoped_lock guard{lock};
+    if (items.empty()) return false;
+    value = front ? items.front() : items.back();
+    return true;
+  }
+
+ private:
+  spin_lock lock;
+  std::deque<T> items;
+};
+
+}  // namespace polylin
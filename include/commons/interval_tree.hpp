@@ -1,45 +1,64 @@
 #pragma once
 
+#include <limits>
 #include <vector>
 
+#include "../stats.hpp"
 #include "mem_alloc.hpp"
 
 namespace polylin {
 
+// Bounds are of `index_type`, wide enough for the times of the history
+template <typename index_type>
 struct interval {
-  int start;
-  int end;
-  interval(int s, int e) : start(s), end(e) {}
+  index_type start;
+  index_type end;
+  interval(index_type s, index_type e) : start(s), end(e) {}
   interval() = default;
 };
 
+template <typename index_type>
 struct interval_tree_node {
-  interval intvl;
-  int maxEnd;
+  interval<index_type> intvl;
+  index_type maxEnd;
   int height;
   interval_tree_node* left;
   interval_tree_node* right;
 
-  interval_tree_node(interval i)
+  interval_tree_node(interval<index_type> i)
       : intvl(i), maxEnd(i.end), height(1), left(nullptr), right(nullptr) {}
 };
 
 // interval tree efficient O(log n) insert/delete of intervals and `O(m log n)`
 // point query
-struct interval_tree : private memory_allocator<interval_tree_node> {
+template <typename index_type>
+struct interval_tree
+    : private memory_allocator<interval_tree_node<index_type>> {
+  typedef interval<index_type> interval_t;
+  typedef interval_tree_node<index_type> node_t;
+  using memory_allocator<node_t>::alloc;
+  using memory_allocator<node_t>::free;
+
  public:
   interval_tree() : root(nullptr) {}
 
   // Newly inserted interval must have unique `start` and `end`
-  void insert(interval i) { root = insert(root, i); }
+  void insert(interval_t i) {
+    POLYLIN_STAT_COUNT(STAT_INTERVAL_TREE_OPS, 1);
+    root = insert(root, i);
+  }
 
   // `i` must exist in the tree for correctness
-  void remove(interval i) { root = remove(root, i); }
+  void remove(interval_t i) {
+    POLYLIN_STAT_COUNT(STAT_INTERVAL_TREE_OPS, 1);
+    root = remove(root, i);
+  }
 
   // Retrieves all intervals overlapping `point`. `O(m log n)` time complexity,
   // where `m` is the size of output and `n` is the size of tree
-  std::vector<interval> query(int point) {
-    std::vector<interval> result;
+  std::vector<interval_t> query(index_type point) {
+    POLYLIN_STAT_COUNT(STAT_INTERVAL_TREE_OPS, 1);
+    std::vector<interval_t> result;
     query(root, point, result);
     return result;
   }
@@ -47,19 +66,21 @@ struct interval_tree : private memory_allocator<interval_tree_node> {
   bool empty() { return root == nullptr; }
 
  private:
-  interval_tree_node* root;
+  node_t* root;
 
-  int height(interval_tree_node* n) { return n ? n->height : 0; }
+  int height(node_t* n) { return n ? n->height : 0; }
 
-  int maxEnd(interval_tree_node* n) { return n ? n->maxEnd : INT32_MIN; }
+  index_type maxEnd(node_t* n) {
+    return n ? n->maxEnd : std::numeric_limits<index_type>::min();
+  }
 
-  int getBalance(interval_tree_node* n) {
+  int getBalance(node_t* n) {
     return n ? height(n->left) - height(n->right) : 0;
   }
 
-  interval_tree_node* rightRotate(interval_tree_node* y) {
-    interval_tree_node* x = y->left;
-    interval_tree_node* T2 = x->right;
+  node_t* rightRotate(node_t* y) {
+    node_t* x = y->left;
+    node_t* T2 = x->right;
 
     x->right = y;
     y->left = T2;
@@ -75,9 +96,9 @@ struct interval_tree : private memory_allocator<interval_tree_node> {
     return x;
   }
 
-  interval_tree_node* leftRotate(interval_tree_node* x) {
-    interval_tree_node* y = x->right;
-    interval_tree_node* T2 = y->left;
+  node_t* leftRotate(node_t* x) {
+    node_t* y = x->right;
+    node_t* T2 = y->left;
 
     y->left = x;
     x->right = T2;
@@ -93,7 +114,7 @@ struct interval_tree : private memory_allocator<interval_tree_node> {
     return y;
   }
 
-  interval_tree_node* autoBalance(interval_tree_node* node) {
+  node_t* autoBalance(node_t* node) {
     int balance = getBalance(node);
     if (balance >= 2) {                  // left heavy
       if (getBalance(node->left) == -1)  // left child is right heavy
@@ -108,8 +129,8 @@ struct interval_tree : private memory_allocator<interval_tree_node> {
     return node;
   }
 
-  interval_tree_node* insert(interval_tree_node* node, interval i) {
-    if (!node) return new (alloc()) interval_tree_node(i);
+  node_t* insert(node_t* node, interval_t i) {
+    if (!node) return new (alloc()) node_t(i);
 
     if (i.start < node->intvl.start)
       node->left = insert(node->left, i);
@@ -123,12 +144,12 @@ struct interval_tree : private memory_allocator<interval_tree_node> {
     return autoBalance(node);
   }
 
-  interval_tree_node* minValueNode(interval_tree_node* node) {
+  node_t* minValueNode(node_t* node) {
     while (node->left != nullptr) node = node->left;
     return node;
   }
 
-  interval_tree_node* remove(interval_tree_node* node, interval i) {
+  node_t* remove(node_t* node, interval_t i) {
     if (!node) return node;
 
     if (i.start < node->intvl.start) {
@@ -137,11 +158,11 @@ struct interval_tree : private memory_allocator<interval_tree_node> {
       node->right = remove(node->right, i);
     } else {
       if (!node->left || !node->right) {
-        interval_tree_node* temp = node->left ? node->left : node->right;
+        node_t* temp = node->left ? node->left : node->right;
         free(node);
         node = temp;
       } else {
-        interval_tree_node* temp = minValueNode(node->right);
+        node_t* temp = minValueNode(node->right);
         node->intvl = temp->intvl;
         node->right = remove(node->right, temp->intvl);
       }
@@ -156,8 +177,8 @@ struct interval_tree : private memory_allocator<interval_tree_node> {
     return autoBalance(node);
   }
 
-  void query(interval_tree_node* node, int point,
-             std::vector<interval>& result) {
+  void query(node_t* node, index_type point,
+             std::vector<interval_t>& result) {
     if (!node) return;
 
     if (node->intvl.start <= point && point <= node->intvl.end)
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+namespace polylin {
+
+// Bitset over `[0, size)` with a 64-ary summary tree on top, supporting
+// `O(log_64 n)` set, reset and maximum queries
+struct max_bitset {
+ public:
+  max_bitset(size_t size) {
+    do {
+      size = (size + 63) / 64;
+      levels.emplace_back(std::max<size_t>(size, 1), 0);
+    } while (size > 1);
+  }
+
+  void set(size_t pos) {
+    for (std::vector<uint64_t>& level : levels) {
+      uint64_t& word = level[pos >> 6];
+      bool wasEmpty = !word;
+      word |= uint64_t{1} << (pos & 63);
+      if (!wasEmpty) return;
+      pos >>= 6;
+    }
+  }
+
+  void reset(size_t pos) {
+    for (std::vector<uint64_t>& level : levels) {
+      uint64_t& word = level[pos >> 6];
+      word &= ~(uint64_t{1} << (pos & 63));
+      if (word) return;
+      pos >>= 6;
+    }
+  }
+
+  bool test(size_t pos) const { return levels[0][pos >> 6] >> (pos & 63) & 1; }
+
+  bool empty() const { return !levels.back()[0]; }
+
+  // Largest set position, bitset must not be empty
+  size_t max() const {
+    size_t pos = 0;
+    for (auto level = levels.rbegin(); level != levels.rend(); ++level)
+      pos = (pos << 6) | (63 - std::countl_zero((*level)[pos]));
+    return pos;
+  }
+
+  // Largest set position below `pos`, or `npos` if there is none
+  size_t prev(size_t pos) const {
+    if ((pos >> 6) >= levels[0].size()) return empty() ? npos : max();
+
+    size_t depth = 0;
+    // Climb until a word holds a set bit below the current position
+    for (; depth < levels.size(); ++depth, pos >>= 6) {
+      uint64_t mask = (uint64_t{1} << (pos & 63)) - 1;
+      uint64_t below = levels[depth][pos >> 6] & mask;
+      if (below) {
+        pos = (pos & ~size_t{63}) | (63 - std::countl_zero(below));
+        break;
+      }
+    }
+    if (depth == levels.size()) return npos;
+    // Descend along the largest set bits
+    while (depth-- > 0)
+      pos = (pos << 6) | (63 - std::countl_zero(levels[depth][pos]));
+    return pos;
+  }
+
+  static constexpr size_t npos = SIZE_MAX;
+
+ private:
+  // `levels[0]` holds the bits, word `i` of level `k` is summarized by bit `i`
+  // of level `k + 1`
+  std::vector<std::vector<uint64_t>> levels;
+};
+
+}  // namespace polylin
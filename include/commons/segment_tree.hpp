@@ -1,40 +1,52 @@
 #pragma once
 
+#include <utility>
 #include <vector>
 
+#include "../stats.hpp"
+
 namespace polylin {
 
 // `O(log n)` range update
 // `O(log n)` point query
 // `O(1)` minimum query segment tree
 // minimum size 1
+// Positions are of `index_type`, values and addends of `weight_type`
+template <typename index_type, typename weight_type = index_type>
 struct segment_tree {
  public:
   segment_tree(const size_t& size) : tree(size * 4), size(size) {
     build(1, 0, size - 1);
   }
 
-  void update_range(int l, int r, int addend) {
+  void update_range(index_type l, index_type r, weight_type addend) {
+    POLYLIN_STAT_COUNT(STAT_SEGMENT_TREE_OPS, 1);
     update_range(1, 0, size - 1, l, r, addend);
   }
 
-  std::pair<int, int> query_min() {
+  std::pair<weight_type, index_type> query_min() {
     return {tree[1].min_value, tree[1].min_pos};
   }
 
-  int query_val(int pos) { return query_val(1, 0, size - 1, pos); }
+  weight_type query_val(index_type pos) {
+    POLYLIN_STAT_COUNT(STAT_SEGMENT_TREE_OPS, 1);
+    return query_val(1, 0, size - 1, pos);
+  }
 
  private:
   struct segment_tree_node {
-    int min_value;
-    int min_pos;
-    int weight;
+    weight_type min_value;
+    index_type min_pos;
+    weight_type weight;
   };
 
-  void build(int v, int tl, int tr) {
+  // Nodes are numbered up to `4 * size`
+  typedef index_type node_t;
+
+  void build(node_t v, index_type tl, index_type tr) {
     tree[v] = {0, tl, 0};
     if (tl != tr) {
-      int tm = (tl + tr) / 2;
+      index_type tm = (tl + tr) / 2;
       build(v * 2, tl, tm);
       build(v * 2 + 1, tm + 1, tr);
     }
@@ -51,7 +63,7 @@ struct segment_tree {
     }
   }
 
-  void propagate(int v) {
+  void propagate(node_t v) {
     if (tree[v].weight != 0) {
       apply(v * 2, tree[v].weight);
       apply(v * 2 + 1, tree[v].weight);
@@ -59,27 +71,29 @@ struct segment_tree {
     }
   }
 
-  void apply(int v, int addend) {
+  void apply(node_t v, weight_type addend) {
     tree[v].min_value += addend;
     tree[v].weight += addend;
   }
 
-  void update_range(int v, int tl, int tr, int l, int r, int addend) {
+  void update_range(node_t v, index_type tl, index_type tr, index_type l,
+                    index_type r, weight_type addend) {
     if (l > r) return;
     if (l == tl && r == tr) {
       apply(v, addend);
     } else {
       propagate(v);
-      int tm = (tl + tr) / 2;
+      index_type tm = (tl + tr) / 2;
       update_range(v * 2, tl, tm, l, std::min(r, tm), addend);
       update_range(v * 2 + 1, tm + 1, tr, std::max(l, tm + 1), r, addend);
       merge(tree[v], tree[v * 2], tree[v * 2 + 1]);
     }
   }
 
-  int query_val(int v, int tl, int tr, int pos) {
+  weight_type query_val(node_t v, index_type tl, index_type tr,
+                        index_type pos) {
     if (tl == tr) return tree[v].weight;
-    int tm = (tl + tr) / 2;
+    index_type tm = (tl + tr) / 2;
     return ((pos <= tm) ? query_val(v * 2, tl, tm, pos)
                         : query_val(v * 2 + 1, tm + 1, tr, pos)) +
            tree[v].weight;
@@ -88,7 +102,7 @@ struct segment_tree {
   // root at `1`, left child at `2*par`, right child at `2*par+1`
   // for odd size ranges, mid belongs to right child
   std::vector<segment_tree_node> tree;
-  int size;
+  index_type size;
 };
 
 }  // namespace polylin
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace polylin {
+
+// Bounded single-producer single-consumer ring buffer linking the stages of a
+// pipeline. Pushes and pops are lock-free, and block on an atomic wait while
+// the ring is full or empty, so that idle stages sleep rather than spin.
+// Closing the ring, from either end, fails later pushes, and pops once the
+// items left are drained.
+template <typename T>
+class spsc_ring {
+ public:
+  explicit spsc_ring(size_t capacity) : slots(capacity) {}
+
+  // Blocks while the ring is full, returns false if it is closed
+  bool push(T item) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (!await([&]() {
+          return t - head.load(std::memory_order_acquire) < slots.size();
+        }))
+      return false;
+    slots[t % slots.size()] = std::move(item);
+    tail.store(t + 1, std::memory_order_release);
+    wake();
+    return true;
+  }
+
+  // Blocks while the ring is empty, returns false once it is closed and
+  // drained
+  bool pop(T& item) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    auto ready = [&]() { return tail.load(std::memory_order_acquire) != h; };
+    if (!await(ready) && !ready()) return false;
+    item = std::move(slots[h % slots.size()]);
+    head.store(h + 1, std::memory_order_release);
+    wake();
+    return true;
+  }
+
+  void close() {
+    closed.store(true, std::memory_order_release);
+    wake();
+  }
+
+ private:
+  // Waits until `ready`, returns false if the ring is closed first
+  template <typename ready_fn>
+  bool await(ready_fn ready) {
+    while (true) {
+      // read before the checks, so that a change after them ends the wait
+      const uint32_t seen = signal.load(std::memory_order_acquire);
+      if (closed.load(std::memory_order_acquire)) return false;
+      if (ready()) return true;
+      waiters.fetch_add(1);
+      signal.wait(seen);
+      waiters.fetch_sub(1);
+    }
+  }
+
+  // Notifies only if the other end may be waiting, sparing a system call
+  void wake() {
+    signal.fetch_add(1);
+    if (waiters.load()) signal.notify_all();
+  }
+
+  std::vector<T> slots;
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+  // Bumped by every change, for the other end to wait on
+  alignas(64) std::atomic<uint32_t> signal{0};
+  std::atomic<uint32_t> waiters{0};
+  std::atomic<bool> closed{false};
+};
+
+}  // namespace polylin
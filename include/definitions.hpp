@@ -1,12 +1,21 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <limits>
+#include <numeric>
+#include <queue>
 #include <stdexcept>
 #include <string>
-#include <unordered_set>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 namespace polylin {
 
-enum Method {
+enum Method : uint8_t {
   PUSH,
   POP,
   PEEK,
@@ -24,125 +33,159 @@ enum Method {
   REMOVE,
 };
 
-inline Method getMethodFromStr(std::string str) {
-  if (str == "push") return Method::PUSH;
-  if (str == "pop") return Method::POP;
-  if (str == "peek") return Method::PEEK;
-  if (str == "push_front") return Method::PUSH_FRONT;
-  if (str == "pop_front") return Method::POP_FRONT;
-  if (str == "peek_front") return Method::PEEK_FRONT;
-  if (str == "push_back") return Method::PUSH_BACK;
-  if (str == "pop_back") return Method::POP_BACK;
-  if (str == "peek_back") return Method::PEEK_BACK;
-  if (str == "enq") return Method::ENQ;
-  if (str == "deq") return Method::DEQ;
-  if (str == "insert") return Method::INSERT;
-  if (str == "poll") return Method::POLL;
-  if (str == "contains") return Method::CONTAINS;
-  if (str == "remove")
-    return Method::REMOVE;
-  else
-    throw std::invalid_argument("Unknown method: " + str);
+// Method names indexed by `Method`
+inline constexpr std::array<std::string_view, 15> methodNames{
+    "push",      "pop",      "peek",      "enq",      "deq",
+    "push_front", "pop_front", "peek_front", "push_back", "pop_back",
+    "peek_back", "insert",   "poll",      "contains", "remove"};
+
+inline Method getMethodFromStr(std::string_view str) {
+  for (size_t i = 0; i < methodNames.size(); ++i)
+    if (methodNames[i] == str) return static_cast<Method>(i);
+  throw std::invalid_argument("Unknown method: " + std::string(str));
 }
 
 // typedef int value_type;
 typedef unsigned long long time_type;
-typedef unsigned int proc_type;
+// Process or thread issuing an operation
+typedef uint16_t proc_type;
+// Index of an operation within its history
 typedef unsigned int id_type;
 
 #define DEFAULT_VALUE_TYPE int
 #define EMPTY_VALUE -1
 #define MIN_TIME std::numeric_limits<time_type>::lowest()
 
+// Process of operations logged without one
+inline constexpr proc_type NO_PROC = std::numeric_limits<proc_type>::max();
+
+// Operations are plain trivially copyable records, identified by their index
+// in the history that owns them. Operations of the same process do not
+// overlap.
 template <typename value_type>
 struct Operation {
-  id_type id;
-  Method method;
-  value_type value;
   time_type startTime;
   time_type endTime;
+  value_type value;
+  Method method;
   bool retVal;
+  proc_type proc;
 
-  Operation() = delete;
+  Operation() = default;
 
   Operation(Method method, value_type value, time_type startTime,
-            time_type endTime, bool retVal)
-      : method(method),
-        value(value),
-        startTime(startTime),
+            time_type endTime, bool retVal = true, proc_type proc = NO_PROC)
+      : startTime(startTime),
         endTime(endTime),
-        retVal(retVal) {
-    static id_type globId = 0;
-    id = ++globId;
-  };
+        value(value),
+        method(method),
+        retVal(retVal),
+        proc(proc) {};
+};
 
-  Operation(Method method, value_type value, time_type startTime,
-            time_type endTime)
-      : Operation(method, value, startTime, endTime, true) {};
-
-  Operation(const Operation& o)
-      : id(o.id),
-        method(o.method),
-        value(o.value),
-        startTime(o.startTime),
-        endTime(o.endTime),
-        retVal(o.retVal) {};
-
-  Operation(const Operation&& o)
-      : id(o.id),
-        method(o.method),
-        value(o.value),
-        startTime(o.startTime),
-        endTime(o.endTime),
-        retVal(o.retVal) {};
-
-  Operation& operator=(const Operation& o) {
-    id = o.id;
-    method = o.method;
-    value = o.value;
-    startTime = o.startTime;
-    endTime = o.endTime;
-    retVal = o.retVal;
-    return *this;
-  }
+static_assert(std::is_trivially_copyable_v<Operation<DEFAULT_VALUE_TYPE>>);
+static_assert(sizeof(Operation<DEFAULT_VALUE_TYPE>) == 24);
 
-  Operation& operator=(const Operation&& o) {
-    id = o.id;
-    method = o.method;
-    value = o.value;
-    startTime = o.startTime;
-    endTime = o.endTime;
-    retVal = o.retVal;
-    return *this;
-  }
+template <typename value_type>
+using History = std::vector<Operation<value_type>>;
+
+struct check_result {
+  bool linearizable;
+  // Earliest time a violation is observed, only set by incremental checks
+  time_type violationTime;
 };
 
-template <typename value_type>
-inline bool operator<(const Operation<value_type>& a,
-                      const Operation<value_type>& b) {
-  return a.id < b.id;
-}
+// Invocation or response of the operation at index `id` of a history
+struct event {
+  time_type time;
+  bool isInv;
+  id_type id;
+};
 
-template <typename value_type>
-inline bool operator==(const Operation<value_type>& a,
-                       const Operation<value_type>& b) {
-  return a.id == b.id;
+// Responses precede invocations at equal times, ties broken by index
+inline bool operator<(const event& a, const event& b) {
+  return std::tie(a.time, a.isInv, a.id) < std::tie(b.time, b.isInv, b.id);
 }
 
+// Sorted invocation and response events of all operations in `hist`. The
+// events of a process come in program order, so that only those of operations
+// without a process are sorted, and the runs of all processes are merged on a
+// heap, in O(n log p) for p processes. Runs out of order, of processes with
+// overlapping operations, are sorted first.
 template <typename value_type>
-inline bool operator!=(const Operation<value_type>& a,
-                       const Operation<value_type>& b) {
-  return !(a == b);
+std::vector<event> getEvents(const History<value_type>& hist) {
+  // Runs by process, that of operations without one last
+  size_t numProcs = 0;
+  for (const auto& o : hist)
+    if (o.proc != NO_PROC) numProcs = std::max<size_t>(numProcs, o.proc + 1);
+  auto runOf = [&](const Operation<value_type>& o) {
+    return o.proc == NO_PROC ? numProcs : o.proc;
+  };
+  std::vector<size_t> runStart(numProcs + 2);
+  for (const auto& o : hist) runStart[runOf(o) + 1] += 2;
+  std::partial_sum(runStart.begin(), runStart.end(), runStart.begin());
+
+  std::vector<event> runs(2 * hist.size());
+  std::vector<size_t> pos(runStart.begin(), runStart.end() - 1);
+  for (id_type i = 0; i < hist.size(); ++i) {
+    size_t& p = pos[runOf(hist[i])];
+    runs[p++] = {hist[i].startTime, true, i};
+    runs[p++] = {hist[i].endTime, false, i};
+  }
+
+  // Unmerged parts of the runs, ordered by their first event
+  typedef std::pair<size_t, size_t> range;
+  auto later = [&](const range& a, const range& b) {
+    return runs[b.first] < runs[a.first];
+  };
+  std::priority_queue<range, std::vector<range>, decltype(later)> heads(later);
+  for (size_t r = 0; r + 1 < runStart.size(); ++r) {
+    const size_t begin = runStart[r], end = runStart[r + 1];
+    if (begin == end) continue;
+    if (!std::is_sorted(runs.begin() + begin, runs.begin() + end))
+      std::sort(runs.begin() + begin, runs.begin() + end);
+    // a single run is sorted already
+    if (end - begin == runs.size()) return runs;
+    heads.push({begin, end});
+  }
+
+  std::vector<event> events;
+  events.reserve(runs.size());
+  while (!heads.empty()) {
+    auto [begin, end] = heads.top();
+    heads.pop();
+    events.push_back(runs[begin]);
+    if (++begin != end) heads.push({begin, end});
+  }
+  return events;
 }
 
-template <typename value_type>
-using History = std::unordered_set<Operation<value_type>>;
+// Id of the value of empty operations
+inline constexpr uint32_t NO_VALUE = std::numeric_limits<uint32_t>::max();
 
-}  // namespace polylin
+// Sorted events and dense value ids of a history, derived by preprocessing
+// unless given ahead
+struct history_index {
+  std::vector<event> events;
+  // Dense id of the value of every operation, `NO_VALUE` if empty
+  std::vector<uint32_t> valueOf;
+  uint32_t numValues = 0;
+};
 
+// Index of `hist` without events, values numbered by first occurrence
 template <typename value_type>
-struct std::hash<polylin::Operation<value_type>> {
-  std::size_t operator()(const polylin::Operation<value_type>& o) const {
-    return std::hash<polylin::id_type>()(o.id);
+history_index indexValues(const History<value_type>& hist) {
+  history_index index;
+  index.valueOf.resize(hist.size(), NO_VALUE);
+  std::unordered_map<value_type, uint32_t> ids;
+  ids.reserve(hist.size());
+  for (id_type i = 0; i < hist.size(); ++i) {
+    if (hist[i].value == EMPTY_VALUE) continue;
+    auto [iter, inserted] = ids.try_emplace(hist[i].value, index.numValues);
+    index.numValues += inserted;
+    index.valueOf[i] = iter->second;
   }
-};
\ No newline at end of file
+  return index;
+}
+
+}  // namespace polylin
@@ -12,18 +12,16 @@
 namespace polylin {
 
 template <typename value_type>
-class DequeLin : public LinBase<value_type> {
+class DequeLin : public LinBase<value_type, deque_traits> {
   typedef Operation<value_type> oper_t;
   typedef History<value_type> hist_t;
+  typedef LinBase<value_type, deque_traits> base_t;
 
  public:
-  DequeLin()
-      : LinBase<value_type>{{PUSH_FRONT, PUSH_BACK}, {POP_FRONT, POP_BACK}} {}
-
   // Assumption: at most one `PUSH`, valid deque oper_ts.
   // Time complexity: O(n^3)
-  bool distVal(hist_t& hist) {
-    if (!LinBase<value_type>::preprocess(hist)) return false;
+  bool distVal(hist_t hist) {
+    if (!base_t::preprocess(hist)) return false;
 
     DistValParams params;
     getOneSidedVals(hist, params.oneSidedVals);
@@ -32,16 +30,15 @@ class DequeLin : public LinBase<value_type> {
     removeConcurrentOneSided(hist, params.oneSidedVals);
 
     for (const oper_t& o : hist) {
-      params.events.emplace_back(o.startTime, true, o);
-      params.events.emplace_back(o.endTime, false, o);
       if (o.method == Method::PUSH_FRONT) params.pushFrontVals.insert(o.value);
       if (o.method == Method::POP_FRONT) params.popFrontVals.insert(o.value);
-      params.frontSizeByVal[o.value] += isFrontMethod(o.method);
+      params.frontSizeByVal[o.value] += deque_traits::isFront(o.method);
       ++params.sizeByVal[o.value];
     }
-    std::sort(params.events.begin(), params.events.end());
+    params.events = getEvents(hist);
+    params.hist = std::move(hist);
 
-    size_t n = hist.size();
+    size_t n = params.hist.size();
     std::vector<std::vector<std::optional<bool>>> distValMat = std::vector(
         2 * n, std::vector<std::optional<bool>>(2 * n, std::nullopt));
 
@@ -50,7 +47,8 @@ class DequeLin : public LinBase<value_type> {
 
  private:
   struct DistValParams {
-    std::vector<std::tuple<time_type, bool, oper_t>> events;
+    hist_t hist;
+    std::vector<event> events;
     std::unordered_set<value_type> oneSidedVals;
     std::unordered_map<value_type, size_t> sizeByVal;
     std::unordered_map<value_type, size_t> frontSizeByVal;
@@ -75,7 +73,7 @@ class DequeLin : public LinBase<value_type> {
     for (const oper_t& o : hist) {
       if (!oneSidedVals.count(o.value) ||
           minResTime[o.value] < maxInvTime[o.value])
-        dup.emplace(o);
+        dup.push_back(o);
     }
     std::swap(dup, hist);
   }
@@ -84,7 +82,7 @@ class DequeLin : public LinBase<value_type> {
                        std::unordered_set<value_type>& vals) {
     std::unordered_set<value_type> backVals;
     for (const oper_t& o : hist) {
-      if (isFrontMethod(o.method))
+      if (deque_traits::isFront(o.method))
         vals.insert(o.value);
       else
         backVals.insert(o.value);
@@ -106,38 +104,22 @@ class DequeLin : public LinBase<value_type> {
       if (!vals.count(oldOp.value)) continue;
 
       oper_t newOp{oldOp};
-      if (isPush(oldOp.method))
+      if (deque_traits::isAdd(oldOp.method))
         newOp.method = Method::PUSH;
-      else if (isPeek(oldOp.method))
+      else if (deque_traits::isObserve(oldOp.method))
         newOp.method = Method::PEEK;
-      else if (isPop(oldOp.method))
+      else if (deque_traits::isRemove(oldOp.method))
         newOp.method = Method::POP;
 
-      if (isFrontMethod(oldOp.method)) {
-        frontHist.emplace(std::move(newOp));
+      if (deque_traits::isFront(oldOp.method)) {
+        frontHist.push_back(newOp);
       } else
-        backHist.emplace(std::move(newOp));
+        backHist.push_back(newOp);
     }
 
     StackLin<value_type> stackLin;
-    return stackLin.distVal(frontHist) && stackLin.distVal(backHist);
-  }
-
-  static bool isFrontMethod(Method method) {
-    return method == Method::PUSH_FRONT || method == Method::PEEK_FRONT ||
-           method == Method::POP_FRONT;
-  }
-
-  static bool isPush(Method method) {
-    return method == Method::PUSH_FRONT || method == Method::PUSH_BACK;
-  }
-
-  static bool isPop(Method method) {
-    return method == Method::POP_FRONT || method == Method::POP_BACK;
-  }
-
-  static bool isPeek(Method method) {
-    return method == Method::PEEK_FRONT || method == Method::PEEK_BACK;
+    return stackLin.distVal(std::move(frontHist)) &&
+           stackLin.distVal(std::move(backHist));
   }
 
   void findGoodVals(const size_t& i, const size_t& j,
@@ -145,30 +127,31 @@ class DequeLin : public LinBase<value_type> {
                     std::unordered_set<value_type>& goodVals) {
     std::unordered_map<value_type, size_t> ongoings;
     std::unordered_set<value_type> badVals;
-    for (int k = 0; k < std::max(i, j); ++k) {
-      const auto& [time, isInv, o] = params.events[k];
+    for (size_t k = 0; k < std::max(i, j); ++k) {
+      const auto& [time, isInv, id] = params.events[k];
+      const oper_t& o = params.hist[id];
       if (isInv) {
-        if (k < i && isFrontMethod(o.method)) {
+        if (k < i && deque_traits::isFront(o.method)) {
           if (o.method == Method::PEEK_FRONT ||
               (i <= j && o.method == Method::PUSH_FRONT) ||
               (i >= j && o.method == Method::POP_FRONT))
             ++ongoings[o.value];
         }
-        if (k < j && !isFrontMethod(o.method)) {
+        if (k < j && !deque_traits::isFront(o.method)) {
           if (o.method == Method::PEEK_BACK ||
               (i >= j && o.method == Method::PUSH_BACK) ||
               (i <= j && o.method == Method::POP_BACK))
             ++ongoings[o.value];
         }
       } else {
-        if (k < i && isFrontMethod(o.method)) {
+        if (k < i && deque_traits::isFront(o.method)) {
           if (o.method == Method::PEEK_FRONT ||
               (i <= j && o.method == Method::PUSH_FRONT) ||
               (i >= j && o.method == Method::POP_FRONT))
             --ongoings[o.value];
           badVals.insert(o.value);
         }
-        if (k < j && !isFrontMethod(o.method)) {
+        if (k < j && !deque_traits::isFront(o.method)) {
           if (o.method == Method::PEEK_BACK ||
               (i >= j && o.method == Method::PUSH_BACK) ||
               (i <= j && o.method == Method::POP_BACK))
@@ -195,6 +178,7 @@ class DequeLin : public LinBase<value_type> {
   bool distValHelper(const size_t& i, const size_t& j,
                      std::vector<std::vector<std::optional<bool>>>& distValMat,
                      const DistValParams& params) {
+    POLYLIN_STAT_COUNT(STAT_DEQUE_STATES, 1);
     size_t n = params.events.size();
     if (i == n || j == n) return true;
     if (distValMat[i][j].has_value()) return distValMat[i][j].value();
@@ -215,34 +199,37 @@ class DequeLin : public LinBase<value_type> {
     std::unordered_set<value_type> pendingFrontVals(goodVals),
         pendingBackVals(goodVals);
 
-    for (int k = 0; k < n; ++k) {
-      const auto& [_, isInv, o] = params.events[k];
+    for (size_t k = 0; k < n; ++k) {
+      const auto& [_, isInv, id] = params.events[k];
+      const oper_t& o = params.hist[id];
 
       if (isInv) {
-        if (params.oneSidedVals.count(o.value) && isPop(o.method)) {
-          if (isFrontMethod(o.method))
+        if (params.oneSidedVals.count(o.value) &&
+            deque_traits::isRemove(o.method)) {
+          if (deque_traits::isFront(o.method))
             critValsFront.erase(o.value);
           else
             critValsBack.erase(o.value);
         } else if (goodVals.count(o.value)) {
-          if (isFrontMethod(o.method))
-            frontOngoing.insert(o);
+          if (deque_traits::isFront(o.method))
+            frontOngoing.insert(o, id);
           else
-            backOngoing.insert(o);
+            backOngoing.insert(o, id);
         }
       } else {
-        if (params.oneSidedVals.count(o.value) && isPush(o.method)) {
-          if (isFrontMethod(o.method))
+        if (params.oneSidedVals.count(o.value) &&
+            deque_traits::isAdd(o.method)) {
+          if (deque_traits::isFront(o.method))
             critValsFront.insert(o.value);
           else
             critValsBack.insert(o.value);
         } else if (goodVals.count(o.value)) {
-          if (frontOngoing.contains(o) || backOngoing.contains(o)) {
+          if (frontOngoing.contains(o, id) || backOngoing.contains(o, id)) {
             invalidVals.insert(o.value);
             pendingFrontVals.erase(o.value);
             pendingBackVals.erase(o.value);
           }
-          if (isFrontMethod(o.method)) {
+          if (deque_traits::isFront(o.method)) {
             std::unordered_set<value_type> tmp;
             for (const value_type& v : pendingFrontVals)
               if (v != o.value)
@@ -355,26 +342,26 @@ class DequeLin : public LinBase<value_type> {
     std::unordered_set<value_type> peekable, popable;
     std::unordered_set<value_type> peekableNow, popableNow;
 
-    void insert(const oper_t& o) {
-      if (DequeLin::isPush(o.method))
+    void insert(const oper_t& o, id_type id) {
+      if (deque_traits::isAdd(o.method))
         ongoingPush.insert(o.value);
-      else if (DequeLin::isPop(o.method)) {
+      else if (deque_traits::isRemove(o.method)) {
         ongoingPop.insert(o.value);
         if (popable.count(o.value)) popableNow.insert(o.value);
       } else {
-        ongoingPeek[o.value].insert(o.id);
+        ongoingPeek[o.value].insert(id);
         if (peekable.count(o.value)) peekableNow.insert(o.value);
       }
     }
 
-    void erase(const oper_t& o) {
-      if (DequeLin::isPush(o.method))
+    void erase(const oper_t& o, id_type id) {
+      if (deque_traits::isAdd(o.method))
         ongoingPush.erase(o.value);
-      else if (DequeLin::isPop(o.method)) {
+      else if (deque_traits::isRemove(o.method)) {
         ongoingPop.erase(o.value);
         popableNow.erase(o.value);
       } else {
-        ongoingPeek[o.value].erase(o.id);
+        ongoingPeek[o.value].erase(id);
         if (ongoingPeek[o.value].empty()) {
           ongoingPeek.erase(o.value);
           peekableNow.erase(o.value);
@@ -382,13 +369,13 @@ class DequeLin : public LinBase<value_type> {
       }
     }
 
-    bool contains(const oper_t& o) {
-      if (DequeLin::isPush(o.method))
+    bool contains(const oper_t& o, id_type id) {
+      if (deque_traits::isAdd(o.method))
         return ongoingPush.count(o.value);
-      else if (DequeLin::isPop(o.method))
+      else if (deque_traits::isRemove(o.method))
         return ongoingPop.count(o.value);
       else
-        return ongoingPeek.count(o.value) && ongoingPeek[o.value].count(o.id);
+        return ongoingPeek.count(o.value) && ongoingPeek[o.value].count(id);
     }
 
     void markPeekable(const value_type& v) {
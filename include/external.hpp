@@ -0,0 +1,352 @@
+#pragma once
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "commons/spsc_ring.hpp"
+#include "reader.hpp"
+#include "stats.hpp"
+#include "traits.hpp"
+
+namespace polylin {
+
+// Checking of histories larger than memory. The operations are sorted by
+// start time with an external merge sort, spilling sorted runs to temporary
+// files, and the merged stream is cut into segments at quiescent points:
+// times no operation spans and at which the container is certainly empty,
+// every value added having been removed. Segments are then independent, and
+// the history is linearizable iff all of them are, so each is checked in
+// memory on its own.
+namespace external_detail {
+
+// Smallest memory limit, in bytes
+constexpr size_t MIN_MEM_LIMIT = size_t{1} << 20;
+
+// Estimated peak bytes per operation of checking a segment in memory
+constexpr size_t CHECK_BYTES_PER_OP = 128;
+
+template <typename oper_t>
+bool startsBefore(const oper_t& a, const oper_t& b) {
+  return std::tie(a.startTime, a.endTime) < std::tie(b.startTime, b.endTime);
+}
+
+// Operations spilled to an unlinked temporary file under `TMPDIR`
+template <typename value_type>
+class RunFile {
+  typedef Operation<value_type> oper_t;
+
+ public:
+  RunFile() {
+    const char* dir = std::getenv("TMPDIR");
+    std::string path = std::string(dir && *dir ? dir : "/tmp") +
+                       "/polylin-run-XXXXXX";
+    int fd = mkstemp(path.data());
+    if (fd < 0) fail("Cannot create temporary run");
+    unlink(path.c_str());
+    file = fdopen(fd, "w+b");
+    if (!file) {
+      close(fd);
+      fail("Cannot open temporary run");
+    }
+  }
+
+  ~RunFile() { std::fclose(file); }
+
+  RunFile(const RunFile&) = delete;
+  RunFile& operator=(const RunFile&) = delete;
+
+  void write(const std::vector<oper_t>& ops) {
+    if (std::fwrite(ops.data(), sizeof(oper_t), ops.size(), file) !=
+        ops.size())
+      fail("Cannot write temporary run");
+  }
+
+  void rewind() {
+    if (std::fflush(file) || std::fseek(file, 0, SEEK_SET))
+      fail("Cannot rewind temporary run");
+  }
+
+  // Replaces `ops` with up to `num` next operations of the run
+  void read(std::vector<oper_t>& ops, size_t num) {
+    ops.resize(num);
+    ops.resize(std::fread(ops.data(), sizeof(oper_t), num, file));
+    if (std::ferror(file)) fail("Cannot read temporary run");
+  }
+
+ private:
+  [[noreturn]] static void fail(const std::string& what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+  }
+
+  std::FILE* file;
+};
+
+// Operations of a history in start time order, merged from sorted runs of at
+// most `runSize` operations each
+template <typename value_type>
+class SortedStream {
+  typedef Operation<value_type> oper_t;
+
+  struct cursor {
+    RunFile<value_type> run;
+    std::vector<oper_t> buffer;
+    size_t pos = 0;
+  };
+
+ public:
+  // Sorts the operations appended by `read` to a history until it returns
+  // false
+  template <typename read_fn>
+  SortedStream(read_fn read, size_t runSize, size_t mergeBytes) {
+    POLYLIN_STAT_SCOPE(STAT_EXTERNAL_SORT);
+    while (read(head)) {
+      if (head.size() < runSize) continue;
+      spill();
+    }
+    std::sort(head.begin(), head.end(), startsBefore<oper_t>);
+    if (runs.empty()) return;
+    if (!head.empty()) spill();
+    head = std::vector<oper_t>();
+
+    bufferSize = std::max<size_t>(mergeBytes / runs.size() / sizeof(oper_t),
+                                  1);
+    for (size_t i = 0; i < runs.size(); ++i) {
+      runs[i]->run.rewind();
+      refill(i);
+    }
+  }
+
+  // Takes the next operation into `o`, returns false once exhausted
+  bool next(oper_t& o) {
+    if (runs.empty()) {
+      if (headPos == head.size()) return false;
+      o = head[headPos++];
+      return true;
+    }
+    if (heap.empty()) return false;
+    size_t i = heap.top().second;
+    heap.pop();
+    cursor& c = *runs[i];
+    o = c.buffer[c.pos++];
+    refill(i);
+    return true;
+  }
+
+ private:
+  // Sorts the operations read so far and writes them as a run
+  void spill() {
+    std::sort(head.begin(), head.end(), startsBefore<oper_t>);
+    runs.push_back(std::make_unique<cursor>());
+    runs.back()->run.write(head);
+    head.clear();
+    POLYLIN_STAT_COUNT(STAT_EXTERNAL_RUNS, 1);
+  }
+
+  // Pushes the next operation of run `i` on the heap, reading more of the
+  // run once its buffer is consumed
+  void refill(size_t i) {
+    cursor& c = *runs[i];
+    if (c.pos == c.buffer.size()) {
+      c.run.read(c.buffer, bufferSize);
+      c.pos = 0;
+      if (c.buffer.empty()) return;
+    }
+    heap.emplace(c.buffer[c.pos], i);
+  }
+
+  struct later {
+    bool operator()(const std::pair<oper_t, size_t>& a,
+                    const std::pair<oper_t, size_t>& b) const {
+      return startsBefore(b.first, a.first) ||
+             (!startsBefore(a.first, b.first) && a.second > b.second);
+    }
+  };
+
+  // Operations not spilled, the whole history if it fits a single run
+  std::vector<oper_t> head;
+  size_t headPos = 0;
+  std::vector<std::unique_ptr<cursor>> runs;
+  size_t bufferSize = 0;
+  std::priority_queue<std::pair<oper_t, size_t>,
+                      std::vector<std::pair<oper_t, size_t>>, later>
+      heap;
+};
+
+// Operations between two quiescent points, checked on their own
+template <typename value_type>
+struct segment {
+  History<value_type> ops;
+  // Start time of the operation the segment was cut before for lack of a
+  // quiescent point within the memory limit, if so
+  std::optional<time_type> cutShort;
+};
+
+// Cuts `ops` into segments of at most `segmentSize` operations passed to
+// `emit`, until it returns false or a segment is cut short
+template <typename value_type, typename traits, typename emit_fn>
+void cutSegments(SortedStream<value_type>& ops, size_t segmentSize,
+                 emit_fn emit) {
+  segment<value_type> seg;
+  // Adds minus removes of the values of the segment, those balanced erased
+  std::unordered_map<value_type, int64_t> balance;
+  time_type maxEnd = 0;
+
+  Operation<value_type> o;
+  while (ops.next(o)) {
+    if (!seg.ops.empty() && maxEnd < o.startTime && balance.empty() &&
+        !emit(std::exchange(seg, {})))
+      return;
+    if (seg.ops.size() == segmentSize) {
+      seg.cutShort = o.startTime;
+      emit(std::move(seg));
+      return;
+    }
+
+    seg.ops.push_back(o);
+    maxEnd = std::max(maxEnd, o.endTime);
+    if (o.value == EMPTY_VALUE) continue;
+    int64_t delta = traits::isAdd(o.method)      ? 1
+                    : traits::isRemove(o.method) ? -1
+                                                 : 0;
+    if (!delta) continue;
+    auto [iter, inserted] = balance.try_emplace(o.value, 0);
+    if (!(iter->second += delta)) balance.erase(iter);
+  }
+  if (!seg.ops.empty()) emit(std::move(seg));
+}
+
+// Checks a segment. One cut short is checked by its sub-history at the cut,
+// which holds operations started before only. It may already show a
+// violation, which values left unbalanced by a lost or phantom remove would
+// otherwise hide; `noQuiescent` is set to the cut if it does not.
+template <typename value_type>
+check_result checkSegment(Monitor<value_type>& monitor,
+                          segment<value_type> seg, bool incremental,
+                          std::optional<time_type>& noQuiescent) {
+  POLYLIN_STAT_COUNT(STAT_EXTERNAL_SEGMENTS, 1);
+  if (!seg.cutShort)
+    return checkHistory(monitor, std::move(seg.ops), incremental);
+  History<value_type> prefix =
+      monitor.getSubHists(std::move(seg.ops))->at(*seg.cutShort, nullptr);
+  check_result result = checkHistory(monitor, std::move(prefix), incremental);
+  if (result.linearizable) noQuiescent = seg.cutShort;
+  return result;
+}
+
+// Depth of the rings between pipeline stages
+constexpr size_t PIPELINE_DEPTH = 4;
+
+}  // namespace external_detail
+
+// Checks the history file at `path` using about `memLimit` bytes of memory.
+// Only queue and priority queue histories are supported. Checking runs as a
+// pipeline of three stages linked by rings: a thread parses batches of the
+// file, another sorts them into runs, then merges the runs and cuts them
+// into segments, and the calling thread checks the segments. Parsing thus
+// overlaps sorting, and merging overlaps checking.
+template <typename value_type>
+check_result checkExternal(const std::string& path, size_t memLimit,
+                           bool incremental) {
+  using namespace external_detail;
+  typedef History<value_type> hist_t;
+  if (memLimit < MIN_MEM_LIMIT)
+    throw std::invalid_argument("Memory limit below 1M");
+  HistoryStream<value_type> in(path);
+  const std::string type = in.getHistTypeStr();
+  if (type != "queue" && type != "pqueue")
+    throw std::invalid_argument(
+        "Memory limits only apply to queue and pqueue histories");
+
+  // Batches in flight take about a sixth of the budget and runs a quarter.
+  // The merge buffers, or the single run kept in memory, then take a quarter,
+  // segment checks another, and segments in flight about a seventh.
+  const size_t readSize = std::max<size_t>(memLimit / 32, 4096);
+  const size_t runSize =
+      std::max<size_t>(memLimit / 4 / sizeof(Operation<value_type>), 1);
+  const size_t mergeBytes = memLimit / 4;
+  const size_t segmentSize =
+      std::max<size_t>(memLimit / 4 / CHECK_BYTES_PER_OP, 1);
+
+  spsc_ring<hist_t> batches{PIPELINE_DEPTH};
+  spsc_ring<segment<value_type>> segments{PIPELINE_DEPTH};
+  std::exception_ptr parseError, sortError;
+
+  std::thread parser([&]() {
+    try {
+      hist_t batch;
+      while (in.read(batch, readSize) && batches.push(std::move(batch)))
+        batch = hist_t();
+    } catch (...) {
+      parseError = std::current_exception();
+    }
+    batches.close();
+  });
+
+  std::thread sorter([&]() {
+    try {
+      SortedStream<value_type> ops(
+          [&](hist_t& head) {
+            hist_t batch;
+            if (!batches.pop(batch)) return false;
+            head.insert(head.end(), batch.begin(), batch.end());
+            return true;
+          },
+          runSize, mergeBytes);
+      auto emit = [&](segment<value_type> seg) {
+        return segments.push(std::move(seg));
+      };
+      if (type == "queue")
+        cutSegments<value_type, queue_traits>(ops, segmentSize, emit);
+      else
+        cutSegments<value_type, pqueue_traits>(ops, segmentSize, emit);
+    } catch (...) {
+      sortError = std::current_exception();
+    }
+    batches.close();
+    segments.close();
+  });
+
+  check_result result{true, 0};
+  std::optional<time_type> noQuiescent;
+  std::exception_ptr checkError;
+  try {
+    std::unique_ptr<Monitor<value_type>> monitor =
+        getMonitor<value_type>(type);
+    segment<value_type> seg;
+    while (result.linearizable && !noQuiescent && segments.pop(seg))
+      result = checkSegment(*monitor, std::move(seg), incremental, noQuiescent);
+  } catch (...) {
+    checkError = std::current_exception();
+  }
+  segments.close();
+  parser.join();
+  sorter.join();
+
+  for (const std::exception_ptr& error : {parseError, sortError, checkError})
+    if (error) std::rethrow_exception(error);
+  if (noQuiescent)
+    throw std::runtime_error(
+        "No quiescent point within the memory limit, at time " +
+        std::to_string(*noQuiescent));
+  return result;
+}
+
+}  // namespace polylin
@@ -0,0 +1,214 @@
+#pragma once
+
+#ifdef POLYLIN_ZLIB
+#include <zlib.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "commons/spsc_ring.hpp"
+#include "stats.hpp"
+
+namespace polylin {
+
+enum class compression { none, gzip, zstd };
+
+// Compression of a file starting with `head`, told by its magic bytes
+inline compression compressionOf(std::string_view head) {
+  if (head.size() >= 2 && head.substr(0, 2) == "\x1f\x8b")
+    return compression::gzip;
+  if (head.size() >= 4 && head.substr(0, 4) == "\x28\xb5\x2f\xfd")
+    return compression::zstd;
+  return compression::none;
+}
+
+inline compression fileCompression(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) throw std::runtime_error("Cannot open file: " + path);
+  char head[4];
+  file.read(head, sizeof(head));
+  return compressionOf({head, size_t(file.gcount())});
+}
+
+[[noreturn]] inline void unsupportedZstd() {
+  throw std::runtime_error(
+      "zstd-compressed histories are not supported, decompress them first");
+}
+
+// Inflates gzip data fed in pieces, concatenated members included
+class GzipInflater {
+ public:
+  GzipInflater() {
+#ifdef POLYLIN_ZLIB
+    // gzip wrapper only
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+      throw std::runtime_error("Cannot initialize zlib");
+#else
+    throw std::runtime_error(
+        "gzip-compressed histories require building with zlib");
+#endif
+  }
+
+#ifdef POLYLIN_ZLIB
+  ~GzipInflater() { inflateEnd(&stream); }
+#endif
+
+  GzipInflater(const GzipInflater&) = delete;
+  GzipInflater& operator=(const GzipInflater&) = delete;
+
+  // Appends the data inflated from `in` to `out`
+  void feed(std::string_view in, std::string& out) {
+#ifdef POLYLIN_ZLIB
+    POLYLIN_STAT_SCOPE(STAT_INFLATE);
+    stream.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    stream.avail_in = in.size();
+    while (stream.avail_in) {
+      if (ended) {
+        inflateReset(&stream);
+        ended = false;
+      }
+      const size_t size = out.size();
+      const size_t room = std::max<size_t>(in.size() * 4, 1 << 16);
+      out.resize(size + room);
+      stream.next_out = reinterpret_cast<Bytef*>(out.data() + size);
+      stream.avail_out = room;
+      int status = inflate(&stream, Z_NO_FLUSH);
+      out.resize(size + room - stream.avail_out);
+      if (status == Z_STREAM_END)
+        ended = true;
+      else if (status != Z_OK && status != Z_BUF_ERROR)
+        throw std::invalid_argument("Corrupt gzip history");
+    }
+#endif
+  }
+
+  // Throws unless the data fed ended with a whole member
+  void finish() const {
+    if (!ended) throw std::invalid_argument("Truncated gzip history");
+  }
+
+ private:
+#ifdef POLYLIN_ZLIB
+  z_stream stream{};
+#endif
+  bool ended = false;
+};
+
+// `text`, or the data it inflates to in `scratch` if gzip-compressed
+inline std::string_view decompressed(std::string_view text,
+                                     std::string& scratch) {
+  switch (compressionOf(text)) {
+    case compression::none:
+      return text;
+    case compression::zstd:
+      unsupportedZstd();
+    case compression::gzip:
+      break;
+  }
+  GzipInflater inflater;
+  scratch.clear();
+  inflater.feed(text, scratch);
+  inflater.finish();
+  return scratch;
+}
+
+// Bytes of a file, inflated ahead on a separate thread if gzip-compressed,
+// so that inflating overlaps parsing
+class InputFile {
+  // Bytes read from the file, and inflated into chunks, at a time
+  static constexpr size_t INPUT_SIZE = size_t{1} << 18;
+  static constexpr size_t CHUNK_SIZE = size_t{1} << 20;
+  // Inflated chunks in flight
+  static constexpr size_t DEPTH = 4;
+
+ public:
+  explicit InputFile(const std::string& path)
+      : file(path, std::ios::binary) {
+    if (!file) throw std::runtime_error("Cannot open file: " + path);
+    char head[4];
+    file.read(head, sizeof(head));
+    const compression kind = compressionOf({head, size_t(file.gcount())});
+    file.clear();
+    file.seekg(0);
+    if (kind == compression::zstd) unsupportedZstd();
+    if (kind == compression::none) return;
+
+    GzipInflater probe;  // fails here without zlib
+    chunks = std::make_unique<spsc_ring<std::string>>(DEPTH);
+    inflater = std::thread([this]() { inflateAll(); });
+  }
+
+  ~InputFile() {
+    if (!inflater.joinable()) return;
+    chunks->close();
+    inflater.join();
+  }
+
+  InputFile(const InputFile&) = delete;
+  InputFile& operator=(const InputFile&) = delete;
+
+  bool compressed() const { return chunks != nullptr; }
+
+  // Reads up to `size` bytes into `buf`, fewer only at the end of the file
+  size_t read(char* buf, size_t size) {
+    if (!chunks) {
+      file.read(buf, size);
+      return file.gcount();
+    }
+    size_t done = 0;
+    while (done < size) {
+      if (chunkPos == chunk.size()) {
+        chunkPos = 0;
+        chunk.clear();
+        if (!chunks->pop(chunk)) {
+          if (inflater.joinable()) inflater.join();
+          if (error) std::rethrow_exception(error);
+          break;
+        }
+      }
+      const size_t n = std::min(size - done, chunk.size() - chunkPos);
+      std::memcpy(buf + done, chunk.data() + chunkPos, n);
+      chunkPos += n;
+      done += n;
+    }
+    return done;
+  }
+
+ private:
+  void inflateAll() {
+    try {
+      GzipInflater gzip;
+      std::string in(INPUT_SIZE, '\0'), out;
+      while (file.read(in.data(), in.size()) || file.gcount()) {
+        gzip.feed({in.data(), size_t(file.gcount())}, out);
+        if (out.size() < CHUNK_SIZE) continue;
+        if (!chunks->push(std::move(out))) return;
+        out = std::string();
+      }
+      gzip.finish();
+      if (!out.empty()) chunks->push(std::move(out));
+    } catch (...) {
+      error = std::current_exception();
+    }
+    chunks->close();
+  }
+
+  std::ifstream file;
+  std::unique_ptr<spsc_ring<std::string>> chunks;
+  std::thread inflater;
+  std::exception_ptr error;
+  // Chunk being read, and the position in it
+  std::string chunk;
+  size_t chunkPos = 0;
+};
+
+}  // namespace polylin
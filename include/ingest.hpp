@@ -0,0 +1,352 @@
+#pragma once
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "stats.hpp"
+
+namespace polylin {
+
+// Ways of reading history files ahead of their checks
+enum class io_method { automatic, uring, pread };
+
+inline io_method parseIoMethod(std::string_view str) {
+  if (str == "auto") return io_method::automatic;
+  if (str == "uring") return io_method::uring;
+  if (str == "pread") return io_method::pread;
+  throw std::invalid_argument("Unknown I/O method: " + std::string(str));
+}
+
+// File read by a `FileLoader`, with the reason if it could not be
+struct loaded_file {
+  size_t tag;
+  std::string error;
+};
+
+// Reads whole files into caller buffers, keeping several reads in flight.
+// Files may complete out of submission order.
+class FileLoader {
+ public:
+  virtual ~FileLoader() = default;
+
+  // Starts reading the file at `path` into `text`, which must be left alone
+  // until the file completes
+  void submit(size_t tag, const std::string& path, std::string& text) {
+    ++numPending;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      if (fd >= 0) close(fd);
+      done.push_back({tag, "Cannot open file: " + path});
+      return;
+    }
+    text.resize(st.st_size);
+    start(tag, fd, text);
+  }
+
+  // Waits for the next file to complete
+  loaded_file wait() {
+    POLYLIN_STAT_SCOPE(STAT_READ);
+    while (done.empty()) await();
+    loaded_file file = std::move(done.front());
+    done.pop_front();
+    --numPending;
+    return file;
+  }
+
+  // Files submitted and not waited for yet
+  size_t pending() const { return numPending; }
+
+ protected:
+  // Starts reading the open file `fd` into `text`, sized to fit, closing
+  // `fd` once done
+  virtual void start(size_t tag, int fd, std::string& text) = 0;
+
+  // Waits for some reads to complete, moving the files done to `done`
+  virtual void await() = 0;
+
+  static std::string errorOf(int err) {
+    return std::string("Cannot read file: ") + std::strerror(err);
+  }
+
+  std::deque<loaded_file> done;
+
+ private:
+  size_t numPending = 0;
+};
+
+// Reads files one at a time with `pread`, advising the kernel to read every
+// submitted file ahead in the background
+class PreadLoader : public FileLoader {
+  struct file_read {
+    size_t tag;
+    int fd;
+    std::string* text;
+  };
+
+ protected:
+  void start(size_t tag, int fd, std::string& text) override {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    queued.push_back({tag, fd, &text});
+  }
+
+  void await() override {
+    file_read file = queued.front();
+    queued.pop_front();
+    loaded_file result{file.tag, {}};
+    std::string& text = *file.text;
+    for (size_t pos = 0; pos < text.size();) {
+      ssize_t n = pread(file.fd, text.data() + pos, text.size() - pos, pos);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        result.error = errorOf(n < 0 ? errno : EIO);
+        break;
+      }
+      pos += n;
+    }
+    close(file.fd);
+    done.push_back(std::move(result));
+  }
+
+ private:
+  std::deque<file_read> queued;
+};
+
+// Reads files through an io_uring, split into chunks of which up to the
+// depth of the ring are in flight, straight into the caller buffers. Talks
+// to the kernel through raw system calls, needing no library.
+class UringLoader : public FileLoader {
+  struct file_read {
+    size_t tag;
+    int fd;
+    // Chunks queued or in flight
+    size_t chunks;
+    std::string error;
+  };
+  struct chunk_read {
+    uint32_t file;
+    char* buf;
+    uint32_t len;
+    uint64_t offset;
+  };
+
+ public:
+  // Throws if the kernel does not support io_uring
+  explicit UringLoader(unsigned depth = 64, uint32_t chunkSize = 1 << 20)
+      : chunkSize(chunkSize) {
+    io_uring_params params{};
+    ringFd = syscall(__NR_io_uring_setup, depth, &params);
+    if (ringFd < 0)
+      throw std::runtime_error(std::string("Cannot set up io_uring: ") +
+                               std::strerror(errno));
+    sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sqSize = cqSize = std::max(sqSize, cqSize);
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+    try {
+      sqRing = map(sqSize, IORING_OFF_SQ_RING);
+      cqRing = single ? sqRing : map(cqSize, IORING_OFF_CQ_RING);
+      sqes = static_cast<io_uring_sqe*>(map(sqesSize, IORING_OFF_SQES));
+    } catch (const std::runtime_error&) {
+      release();
+      throw;
+    }
+    auto field = [](void* ring, unsigned offset) {
+      return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset);
+    };
+    sqTail = field(sqRing, params.sq_off.tail);
+    sqMask = *field(sqRing, params.sq_off.ring_mask);
+    sqArray = field(sqRing, params.sq_off.array);
+    cqHead = field(cqRing, params.cq_off.head);
+    cqTail = field(cqRing, params.cq_off.tail);
+    cqMask = *field(cqRing, params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(cqRing) +
+                                           params.cq_off.cqes);
+    maxInFlight = params.sq_entries;
+  }
+
+  ~UringLoader() override {
+    // reads in flight write to caller buffers, so they are drained first,
+    // leaving queued chunks unsubmitted. Should waiting fail, closing the
+    // ring cancels the reads left.
+    queued.clear();
+    try {
+      while (inFlight) reap(1);
+    } catch (const std::runtime_error&) {
+    }
+    for (const file_read& file : files)
+      if (file.chunks) close(file.fd);
+    release();
+  }
+
+  UringLoader(const UringLoader&) = delete;
+  UringLoader& operator=(const UringLoader&) = delete;
+
+ protected:
+  void start(size_t tag, int fd, std::string& text) override {
+    uint32_t file;
+    if (freeFiles.empty()) {
+      file = files.size();
+      files.emplace_back();
+    } else {
+      file = freeFiles.back();
+      freeFiles.pop_back();
+    }
+    files[file] = {tag, fd, 0, {}};
+    for (size_t pos = 0; pos < text.size(); pos += chunkSize) {
+      const size_t len = std::min<size_t>(chunkSize, text.size() - pos);
+      queued.push_back({file, text.data() + pos, uint32_t(len), pos});
+      ++files[file].chunks;
+    }
+    if (!files[file].chunks) finish(file);
+  }
+
+  void await() override { reap(1); }
+
+ private:
+  // Unmaps the rings mapped so far and closes the ring
+  void release() {
+    if (sqes) munmap(sqes, sqesSize);
+    if (cqRing && cqRing != sqRing) munmap(cqRing, cqSize);
+    if (sqRing) munmap(sqRing, sqSize);
+    close(ringFd);
+  }
+
+  void* map(size_t size, uint64_t offset) {
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ringFd, offset);
+    if (ptr == MAP_FAILED)
+      throw std::runtime_error(std::string("Cannot map io_uring: ") +
+                               std::strerror(errno));
+    return ptr;
+  }
+
+  // Submits queued chunks while the ring has room, then waits for at least
+  // `minComplete` completions and handles them
+  void reap(unsigned minComplete) {
+    unsigned toSubmit = 0;
+    std::atomic_ref<unsigned> tail{*sqTail};
+    unsigned t = tail.load(std::memory_order_relaxed);
+    while (!queued.empty() && inFlight < maxInFlight) {
+      const uint32_t slot = slotOf(queued.front());
+      queued.pop_front();
+      const chunk_read& chunk = chunks[slot];
+      io_uring_sqe& sqe = sqes[t & sqMask];
+      std::memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = IORING_OP_READ;
+      sqe.fd = files[chunk.file].fd;
+      sqe.addr = reinterpret_cast<uint64_t>(chunk.buf);
+      sqe.len = chunk.len;
+      sqe.off = chunk.offset;
+      sqe.user_data = slot;
+      sqArray[t & sqMask] = t & sqMask;
+      ++t;
+      ++toSubmit;
+      ++inFlight;
+    }
+    tail.store(t, std::memory_order_release);
+
+    if (!inFlight) return;
+    while (syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete,
+                   IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+      if (errno != EINTR)
+        throw std::runtime_error(std::string("io_uring_enter failed: ") +
+                                 std::strerror(errno));
+      toSubmit = 0;
+    }
+
+    std::atomic_ref<unsigned> head{*cqHead};
+    unsigned h = head.load(std::memory_order_relaxed);
+    const unsigned end =
+        std::atomic_ref<unsigned>{*cqTail}.load(std::memory_order_acquire);
+    for (; h != end; ++h) {
+      const io_uring_cqe& cqe = cqes[h & cqMask];
+      complete(cqe.user_data, cqe.res);
+      --inFlight;
+    }
+    head.store(h, std::memory_order_release);
+  }
+
+  // Handles a chunk read of `res` bytes, or error `-res`, requeuing what is
+  // left of a short read
+  void complete(uint32_t slot, int res) {
+    chunk_read& chunk = chunks[slot];
+    file_read& file = files[chunk.file];
+    if (res > 0 && uint32_t(res) < chunk.len) {
+      chunk.buf += res;
+      chunk.len -= res;
+      chunk.offset += res;
+      queued.push_front(chunk);
+      freeChunks.push_back(slot);
+      return;
+    }
+    if (res <= 0 && file.error.empty()) file.error = errorOf(res ? -res : EIO);
+    freeChunks.push_back(slot);
+    if (!--file.chunks) finish(chunk.file);
+  }
+
+  void finish(uint32_t file) {
+    close(files[file].fd);
+    done.push_back({files[file].tag, std::move(files[file].error)});
+    freeFiles.push_back(file);
+  }
+
+  // Slot of `chunk` in `chunks`, passed to the kernel as user data
+  uint32_t slotOf(const chunk_read& chunk) {
+    if (freeChunks.empty()) {
+      chunks.push_back(chunk);
+      return chunks.size() - 1;
+    }
+    uint32_t slot = freeChunks.back();
+    freeChunks.pop_back();
+    chunks[slot] = chunk;
+    return slot;
+  }
+
+  const uint32_t chunkSize;
+  int ringFd;
+  void *sqRing = nullptr, *cqRing = nullptr;
+  size_t sqSize, cqSize, sqesSize;
+  io_uring_sqe* sqes = nullptr;
+  unsigned *sqTail, *sqArray, *cqHead, *cqTail;
+  unsigned sqMask, cqMask;
+  io_uring_cqe* cqes;
+  unsigned maxInFlight, inFlight = 0;
+
+  std::vector<file_read> files;
+  std::vector<uint32_t> freeFiles;
+  std::deque<chunk_read> queued;
+  std::vector<chunk_read> chunks;
+  std::vector<uint32_t> freeChunks;
+};
+
+// Loader for `method`, io_uring unless the kernel lacks it if automatic
+inline std::unique_ptr<FileLoader> makeFileLoader(io_method method) {
+  if (method == io_method::pread) return std::make_unique<PreadLoader>();
+  try {
+    return std::make_unique<UringLoader>();
+  } catch (const std::runtime_error&) {
+    if (method == io_method::uring) throw;
+    return std::make_unique<PreadLoader>();
+  }
+}
+
+}  // namespace polylin
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "definitions.hpp"
+#include "traits.hpp"
+
+namespace polylin {
+
+// Anomalies injected into linearizable histories, each making them
+// non-linearizable:
+// - `swap`: two sequential removes return each other's value, removing
+//   values out of order
+// - `phantom`: an operation returns a value that was never added
+// - `lost`: an operation misses a value that is certainly present
+enum class violation_kind { swap, phantom, lost };
+
+inline violation_kind parseViolationKind(std::string_view str) {
+  if (str == "swap") return violation_kind::swap;
+  if (str == "phantom") return violation_kind::phantom;
+  if (str == "lost") return violation_kind::lost;
+  throw std::invalid_argument("Unknown violation: " + std::string(str));
+}
+
+namespace inject_detail {
+
+// Removes scanned for a second remove to swap with, per first remove
+constexpr size_t SWAP_WINDOW = 4096;
+
+template <typename value_type>
+std::vector<id_type> byStartTime(const History<value_type>& hist) {
+  std::vector<id_type> order(hist.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](id_type a, id_type b) {
+    return hist[a].startTime < hist[b].startTime;
+  });
+  return order;
+}
+
+// Start time of the operation at `depth` of `hist` ordered by start time
+template <typename value_type>
+time_type depthTime(const History<value_type>& hist,
+                    const std::vector<id_type>& order, double depth) {
+  size_t pos = std::clamp(depth, 0.0, 1.0) * hist.size();
+  return hist[order[std::min(pos, order.size() - 1)]].startTime;
+}
+
+template <typename value_type>
+value_type freshValue(const History<value_type>& hist) {
+  value_type maxVal = 0;
+  for (const auto& o : hist) maxVal = std::max(maxVal, o.value);
+  return maxVal + 1;
+}
+
+// Injection into histories of containers with unique values. `inOrder(a1,
+// a2)` tells whether the value added by `a1` must be removed before the one
+// added by `a2`, given that both are present.
+template <typename value_type, typename traits, typename order_fn>
+std::optional<time_type> injectContainer(History<value_type>& hist,
+                                         violation_kind kind, double depth,
+                                         order_fn inOrder) {
+  const std::vector<id_type> order = byStartTime(hist);
+  const time_type from = depthTime(hist, order, depth);
+
+  // Adds of values added once
+  std::unordered_map<value_type, id_type> addOf;
+  std::unordered_set<value_type> repeated;
+  for (id_type id = 0; id < hist.size(); ++id) {
+    const auto& o = hist[id];
+    if (o.value == EMPTY_VALUE || !traits::isAdd(o.method)) continue;
+    if (!addOf.try_emplace(o.value, id).second) repeated.insert(o.value);
+  }
+  for (const value_type& value : repeated) addOf.erase(value);
+
+  // Removes of those values from `from` on, by start time
+  std::vector<id_type> removes;
+  for (id_type id : order) {
+    const auto& o = hist[id];
+    if (o.startTime >= from && traits::isRemove(o.method) &&
+        addOf.count(o.value))
+      removes.push_back(id);
+  }
+  // Whether the value removed by `id` was present throughout the remove
+  auto addedBefore = [&](id_type id) {
+    return hist[addOf[hist[id].value]].endTime < hist[id].startTime;
+  };
+
+  if (kind == violation_kind::phantom) {
+    for (id_type id : order) {
+      auto& o = hist[id];
+      if (o.startTime < from || !traits::isRemove(o.method)) continue;
+      o.value = freshValue(hist);
+      return o.endTime;
+    }
+    return std::nullopt;
+  }
+
+  if (kind == violation_kind::lost) {
+    for (id_type id : removes) {
+      if (!traits::canBeEmpty(hist[id].method) || !addedBefore(id)) continue;
+      hist[id].value = EMPTY_VALUE;
+      return hist[id].endTime;
+    }
+    return std::nullopt;
+  }
+
+  // The first remove takes the value of a later one while its own value
+  // stays present, although that one must be removed first
+  for (size_t i = 0; i < removes.size(); ++i) {
+    auto& r1 = hist[removes[i]];
+    if (!addedBefore(removes[i])) continue;
+    size_t end = std::min(removes.size(), i + 1 + SWAP_WINDOW);
+    for (size_t j = i + 1; j < end; ++j) {
+      auto& r2 = hist[removes[j]];
+      if (r2.startTime <= r1.endTime || r2.method != r1.method ||
+          !inOrder(hist[addOf[r1.value]], hist[addOf[r2.value]]))
+        continue;
+      std::swap(r1.value, r2.value);
+      return r1.endTime;
+    }
+  }
+  return std::nullopt;
+}
+
+// Injection into set histories, where a `lost` key is one reported absent
+// right after a successful insert, with no other operation on it around
+template <typename value_type>
+std::optional<time_type> injectSet(History<value_type>& hist,
+                                   violation_kind kind, double depth) {
+  if (kind == violation_kind::swap)
+    throw std::invalid_argument("Set histories do not support swap");
+  const std::vector<id_type> order = byStartTime(hist);
+  const time_type from = depthTime(hist, order, depth);
+
+  if (kind == violation_kind::phantom) {
+    for (id_type id : order) {
+      auto& o = hist[id];
+      if (o.startTime < from) continue;
+      o = {CONTAINS, freshValue(hist), o.startTime, o.endTime, true, o.proc};
+      return o.endTime;
+    }
+    return std::nullopt;
+  }
+
+  // Operations grouped by key, by start time
+  std::unordered_map<value_type, std::vector<id_type>> byKey;
+  for (id_type id : order) byKey[hist[id].value].push_back(id);
+
+  std::optional<id_type> lost;
+  for (const auto& [key, ids] : byKey) {
+    time_type prefixEnd = MIN_TIME;
+    for (size_t i = 0; i + 1 < ids.size(); ++i) {
+      const auto& ins = hist[ids[i]];
+      const auto& o = hist[ids[i + 1]];
+      bool quiet = prefixEnd < ins.startTime && ins.endTime < o.startTime &&
+                   (i + 2 == ids.size() ||
+                    hist[ids[i + 2]].startTime > o.endTime);
+      prefixEnd = std::max(prefixEnd, ins.endTime);
+      if (!quiet || ins.method != INSERT || !ins.retVal ||
+          o.startTime < from)
+        continue;
+      if (!lost || o.startTime < hist[*lost].startTime) lost = ids[i + 1];
+      break;
+    }
+  }
+  if (!lost) return std::nullopt;
+  // Reports the key absent, an insert succeeding and others failing
+  auto& o = hist[*lost];
+  o.retVal = o.method == INSERT;
+  return o.endTime;
+}
+
+}  // namespace inject_detail
+
+// Injects a violation of `kind` at the first suitable operation starting at
+// or after `depth`, a fraction of `hist` ordered by start time. Returns the
+// response time of the operation that completes the violation, or nothing if
+// no operation is suitable. `hist` must be linearizable.
+template <typename value_type>
+std::optional<time_type> injectViolation(History<value_type>& hist,
+                                         const std::string& type,
+                                         violation_kind kind, double depth) {
+  using namespace inject_detail;
+  if (hist.empty()) return std::nullopt;
+  typedef const Operation<value_type>& oper_ref;
+
+  if (type == "set") return injectSet(hist, kind, depth);
+  if (type == "stack")
+    // the value pushed later must be popped first
+    return injectContainer<value_type, stack_traits>(
+        hist, kind, depth,
+        [](oper_ref a1, oper_ref a2) { return a2.endTime < a1.startTime; });
+  if (type == "queue")
+    return injectContainer<value_type, queue_traits>(
+        hist, kind, depth,
+        [](oper_ref a1, oper_ref a2) { return a1.endTime < a2.startTime; });
+  if (type == "pqueue")
+    return injectContainer<value_type, pqueue_traits>(
+        hist, kind, depth,
+        [](oper_ref a1, oper_ref a2) { return a1.value > a2.value; });
+  if (type == "deque") {
+    if (kind == violation_kind::swap)
+      throw std::invalid_argument("Deque histories do not support swap");
+    return injectContainer<value_type, deque_traits>(
+        hist, kind, depth, [](oper_ref, oper_ref) { return false; });
+  }
+  throw std::invalid_argument("Unknown data type");
+}
+
+}  // namespace polylin
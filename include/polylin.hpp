@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "definitions.hpp"
+
+// In-process API of the `polylin_core` library
+namespace polylin {
+
+typedef DEFAULT_VALUE_TYPE log_value_type;
+
+// History of a concurrent object recorded in process. Every thread appends to
+// a log of its own, registered without locks on its first append, so that
+// recording never serializes the threads under test.
+class HistoryLog {
+ public:
+  // Throws `std::invalid_argument` for unknown data types
+  explicit HistoryLog(const std::string& type);
+  ~HistoryLog();
+
+  HistoryLog(const HistoryLog&) = delete;
+  HistoryLog& operator=(const HistoryLog&) = delete;
+
+  // Timestamp of a monotonic clock shared by all threads
+  static time_type now();
+
+  // Appends a completed operation of the calling thread, whose process is
+  // the number of threads that appended to the log before it
+  void append(Method method, log_value_type value, time_type startTime,
+              time_type endTime, bool retVal = true);
+
+  // The following must not run concurrently with `append`
+
+  // Merged history of all threads
+  History<log_value_type> history() const;
+
+  // Checks the merged history, bisecting for the earliest violation if
+  // `incremental`
+  check_result check(bool incremental = false) const;
+
+  // Drops recorded operations, keeping thread logs registered
+  void clear();
+
+ private:
+  struct impl;
+  std::unique_ptr<impl> pimpl;
+};
+
+}  // namespace polylin
@@ -1,66 +1,380 @@
 #pragma once
 
-#include <map>
-#include <set>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "base.hpp"
+#include "commons/max_bitset.hpp"
 
 namespace polylin {
 
 template <typename value_type>
-class PriorityQueueLin : public LinBase<value_type> {
+class PriorityQueueLin : public LinBase<value_type, pqueue_traits> {
   typedef Operation<value_type> oper_t;
   typedef History<value_type> hist_t;
+  typedef LinBase<value_type, pqueue_traits> base_t;
 
  public:
-  PriorityQueueLin() : LinBase<value_type>{{INSERT}, {POLL}} {}
+  // Assumption: valid priority queue operations, `PEEK` being the only
+  // observer. Histories inserting every priority at most once are checked
+  // exactly, see `distValMultiset` for duplicate priorities.
+  // Time complexity: O(n log n), the sweep itself is O(n log_64 n)
+  bool distVal(hist_t hist) {
+    if (hasDuplicatePriorities(hist)) return distValMultiset(std::move(hist));
+    if (!base_t::preprocess(hist)) return false;
+    if (hist.empty()) return true;
 
-  // Assumption: at most one `INSERT`, valid priority queue operations.
+    size_t numVals;
+    std::vector<uint32_t> rankOf = rankValues(hist, numVals);
+    std::vector<event> events = getEvents(hist);
+
+    // Values with running operations and values certainly in the queue. A
+    // running operation is cleared along with its value, which bumps the
+    // generation of the value.
+    max_bitset runningVal{numVals}, critVal{numVals};
+    std::vector<uint32_t> generation(numVals, 0), opGeneration(hist.size());
+    std::vector<bool> endedVal(numVals);
+
+    for (const auto& [_, isInv, id] : events) {
+      const oper_t& op = hist[id];
+      const uint32_t rank = rankOf[id];
+      if (isInv) {
+        if (!pqueue_traits::isAdd(op.method)) {
+          runningVal.set(rank);
+          opGeneration[id] = generation[rank];
+        }
+
+        if (pqueue_traits::isRemove(op.method)) {
+          critVal.reset(rank);
+          endedVal[rank] = true;
+        }
+      } else {
+        if (!pqueue_traits::isAdd(op.method) && runningVal.test(rank) &&
+            opGeneration[id] == generation[rank])
+          return false;
+
+        if (pqueue_traits::isAdd(op.method) && !endedVal[rank])
+          critVal.set(rank);
+      }
+
+      // Clear running operations of values not below the maximum critical value
+      size_t maxPriorityRank = critVal.empty() ? 0 : critVal.max();
+      while (!runningVal.empty() && runningVal.max() >= maxPriorityRank) {
+        size_t val = runningVal.max();
+        runningVal.reset(val);
+        ++generation[val];
+      }
+    }
+
+    return true;
+  }
+
+ private:
+  static bool hasDuplicatePriorities(const hist_t& hist) {
+    std::unordered_set<value_type> inserted;
+    for (const oper_t& o : hist)
+      if (pqueue_traits::isAdd(o.method) && !inserted.insert(o.value).second)
+        return true;
+    return false;
+  }
+
+  // Ranks of operation values, preserving their order
+  static std::vector<uint32_t> rankValues(const hist_t& hist,
+                                          size_t& numVals) {
+    std::vector<value_type> vals;
+    vals.reserve(hist.size());
+    for (const oper_t& o : hist) vals.push_back(o.value);
+    std::sort(vals.begin(), vals.end());
+    vals.erase(std::unique(vals.begin(), vals.end()), vals.end());
+    numVals = vals.size();
+
+    std::vector<uint32_t> rankOf(hist.size());
+    for (id_type i = 0; i < hist.size(); ++i)
+      rankOf[i] = std::lower_bound(vals.begin(), vals.end(), hist[i].value) -
+                  vals.begin();
+    return rankOf;
+  }
+
+  // Stable counting sort of `keys` below `numKeys`, returns the positions
+  static std::vector<uint32_t> sortByKey(const std::vector<uint32_t>& keys,
+                                         size_t numKeys) {
+    std::vector<uint32_t> start(numKeys + 1, 0), order(keys.size());
+    for (uint32_t key : keys) ++start[key + 1];
+    for (size_t k = 0; k < numKeys; ++k) start[k + 1] += start[k];
+    for (uint32_t i = 0; i < keys.size(); ++i) order[start[keys[i]]++] = i;
+    return order;
+  }
+
+  // Copies of a priority are indistinguishable, so priorities are tracked by
+  // counts. A priority is critical while more of its inserts are certainly
+  // linearized than its polls were invoked, which counts the responded
+  // inserts and those a responded peek needed. Critical priorities do not
+  // depend on the schedule, which lets every poll and peek be linearized as
+  // late as possible, in the last gap between events where no higher
+  // priority is critical, and empty operations in the last gap where none
+  // is.
+  // Exact checking is NP-hard with duplicates, the greedy schedule may reject
+  // histories where an operation must be linearized before its deadline.
   // Time complexity: O(n log n)
-  bool distVal(hist_t& hist) {
-    if (!LinBase<value_type>::preprocess(hist)) return false;
+  bool distValMultiset(hist_t hist) {
+    base_t::validate(hist);
 
-    std::vector<std::tuple<time_type, bool, oper_t>> events;
+    // Fabricate polls for copies that were never polled
+    std::unordered_map<value_type, int64_t> unpolled;
+    time_type maxTime = MIN_TIME;
     for (const oper_t& o : hist) {
-      events.emplace_back(o.startTime, true, o);
-      events.emplace_back(o.endTime, false, o);
+      maxTime = std::max(maxTime, o.endTime);
+      if (o.value == EMPTY_VALUE) continue;
+      if (pqueue_traits::isAdd(o.method)) ++unpolled[o.value];
+      if (pqueue_traits::isRemove(o.method)) --unpolled[o.value];
     }
-    std::sort(events.begin(), events.end());
+    for (const auto& [value, count] : unpolled) {
+      if (count < 0) return false;
+      for (int64_t i = 0; i < count; ++i)
+        hist.emplace_back(POLL, value, maxTime + 1, maxTime + 2);
+    }
+    if (hist.empty()) return true;
 
-    std::map<value_type, std::unordered_set<id_type>> runningOp;
-    std::set<value_type> critVal;
-    std::unordered_set<value_type> endedVal;
+    size_t numVals;
+    std::vector<uint32_t> rankOf = rankValues(hist, numVals);
+    std::vector<event> events = getEvents(hist);
+    const size_t numEvents = events.size();
+    auto isValuePoll = [&](id_type id) {
+      return hist[id].value != EMPTY_VALUE &&
+             pqueue_traits::isRemove(hist[id].method);
+    };
+    auto isValuePeek = [&](id_type id) {
+      return hist[id].value != EMPTY_VALUE &&
+             pqueue_traits::isObserve(hist[id].method);
+    };
 
-    for (const auto& [_, isInv, op] : events) {
-      if (isInv) {
-        if (op.method != Method::INSERT) runningOp[op.value].emplace(op.id);
+    // Bound of the gap after every event, 0 if no rank is critical and the
+    // maximum critical rank plus one otherwise. A rank `r` may be polled or
+    // peeked in a gap iff its bound is at most `r + 1`.
+    std::vector<uint32_t> bound(numEvents);
+    std::vector<size_t> invIdx(hist.size()), resIdx(hist.size());
+    {
+      // Inserts certainly linearized, the responded ones or one more than
+      // the polls responded before a responded peek was invoked, and polls
+      // invoked of every rank
+      std::vector<int64_t> added(numVals, 0), removed(numVals, 0);
+      std::vector<int64_t> addsDone(numVals, 0), pollsDone(numVals, 0);
+      std::vector<int64_t> peekNeeds(hist.size());
+      max_bitset critVal{numVals};
+      for (size_t k = 0; k < numEvents; ++k) {
+        const auto& [_, isInv, id] = events[k];
+        const uint32_t rank = rankOf[id];
+        (isInv ? invIdx : resIdx)[id] = k;
+        if (hist[id].value != EMPTY_VALUE) {
+          const bool wasCrit = added[rank] > removed[rank];
+          if (pqueue_traits::isAdd(hist[id].method)) {
+            if (!isInv) added[rank] = std::max(added[rank], ++addsDone[rank]);
+          } else if (isValuePoll(id)) {
+            isInv ? ++removed[rank] : ++pollsDone[rank];
+          } else if (isInv) {
+            peekNeeds[id] = pollsDone[rank] + 1;
+          } else {
+            added[rank] = std::max(added[rank], peekNeeds[id]);
+          }
+          const bool isCrit = added[rank] > removed[rank];
+          if (isCrit && !wasCrit) critVal.set(rank);
+          if (!isCrit && wasCrit) critVal.reset(rank);
+        }
+        bound[k] = critVal.empty() ? 0 : critVal.max() + 1;
+      }
+    }
 
-        if (op.method == Method::POLL) {
-          critVal.erase(op.value);
-          endedVal.insert(op.value);
+    // Deadline of every poll and peek, the last gap before its response
+    // admitting its rank. Polls and peeks are visited in decreasing rank
+    // while gaps are deleted in decreasing bound, a deleted gap links to the
+    // one before it. Empty operations are due in the last gap without
+    // critical ranks. Operations due in the same gap are chained through
+    // `nextDue`.
+    constexpr id_type NONE = std::numeric_limits<id_type>::max();
+    std::vector<id_type> valueDue(numEvents, NONE), emptyDue(numEvents, NONE);
+    std::vector<id_type> nextDue(hist.size());
+    std::vector<size_t> deadline(hist.size());
+    {
+      std::vector<uint32_t> polls, pollRanks;
+      for (id_type i = 0; i < hist.size(); ++i)
+        if (isValuePoll(i) || isValuePeek(i)) {
+          polls.push_back(i);
+          pollRanks.push_back(rankOf[i]);
         }
-      } else {
-        if (runningOp[op.value].count(op.id)) return false;
+      std::vector<uint32_t> pollOrder = sortByKey(pollRanks, numVals);
+      std::vector<uint32_t> gapOrder = sortByKey(bound, numVals + 1);
 
-        if (op.method == Method::INSERT && !endedVal.count(op.value))
-          critVal.insert(op.value);
+      // Gap `k` is node `k + 1`, node 0 stands for no gap
+      std::vector<size_t> parent(numEvents + 1);
+      for (size_t k = 0; k <= numEvents; ++k) parent[k] = k;
+      auto find = [&](size_t node) {
+        while (parent[node] != node) node = parent[node] = parent[parent[node]];
+        return node;
+      };
+      auto chain = [&](id_type id, size_t node, std::vector<id_type>& due) {
+        if (node == 0 || node - 1 < invIdx[id]) return false;
+        deadline[id] = node - 1;
+        nextDue[id] = due[node - 1];
+        due[node - 1] = id;
+        return true;
+      };
+
+      size_t kept = numEvents;
+      for (size_t p = polls.size(); p-- > 0;) {
+        const id_type id = polls[pollOrder[p]];
+        while (kept > 0 && bound[gapOrder[kept - 1]] > rankOf[id] + 1) {
+          const size_t gap = gapOrder[--kept];
+          parent[gap + 1] = gap;
+        }
+        if (!chain(id, find(resIdx[id]), valueDue)) return false;
       }
 
-      if (critVal.empty()) {
-        runningOp.clear();
-      } else {
-        value_type maxPriorityVal = *critVal.rbegin();
-        while (runningOp.size()) {
-          auto& [val, ops] = *runningOp.rbegin();
-          if (val < maxPriorityVal) break;
+      while (kept > 0 && bound[gapOrder[kept - 1]] > 0) {
+        const size_t gap = gapOrder[--kept];
+        parent[gap + 1] = gap;
+      }
+      for (id_type i = 0; i < hist.size(); ++i)
+        if (hist[i].value == EMPTY_VALUE &&
+            !chain(i, find(resIdx[i]), emptyDue))
+          return false;
+    }
+
+    // Copies are available while their insert was invoked and present while
+    // their insert responded, until a poll is linearized. A poll takes a
+    // present copy if any, and otherwise the copy of the running insert that
+    // responds first, which then does not become present on its response. A
+    // peek without a present copy makes that copy present instead.
+    // Present copies above a linearized operation must have been polled
+    // before it, pulling the running polls of their rank forward by earliest
+    // deadline. Running peeks of a rank are linearized before any poll of the
+    // rank.
+    std::vector<int64_t> available(numVals, 0), present(numVals, 0);
+    // Running inserts of each rank by earliest response, those responded
+    // dropped lazily, and whether the copy of an insert was polled already
+    std::vector<std::vector<id_type>> runningInserts(numVals);
+    std::vector<bool> taken(hist.size());
+    std::vector<std::vector<id_type>> runningPeeks(numVals);
+    std::vector<id_type> runningEmpties;
+    std::vector<std::vector<id_type>> runningPolls(numVals);
+    std::vector<bool> linearized(hist.size());
+    // Event being visited
+    size_t k = 0;
+    // Ranks with present copies
+    max_bitset presentVal{numVals};
 
-          runningOp.erase(val);
+    auto byDeadline = [&](id_type a, id_type b) {
+      return deadline[a] > deadline[b];
+    };
+    auto byResponse = [&](id_type a, id_type b) {
+      return resIdx[a] > resIdx[b];
+    };
+    // Takes the copy of the running insert of `rank` responding first
+    auto takeRunning = [&](uint32_t rank) {
+      auto& inserts = runningInserts[rank];
+      while (resIdx[inserts.front()] <= k) {
+        std::pop_heap(inserts.begin(), inserts.end(), byResponse);
+        inserts.pop_back();
+      }
+      taken[inserts.front()] = true;
+      std::pop_heap(inserts.begin(), inserts.end(), byResponse);
+      inserts.pop_back();
+    };
+    auto linearizePeeks = [&](uint32_t rank) {
+      if (runningPeeks[rank].empty()) return;
+      if (present[rank] == 0) {
+        // Running empty operations and peeks of the top present rank below
+        // observe the queue before the copy is present
+        if (presentVal.empty()) {
+          for (id_type emptyId : runningEmpties) linearized[emptyId] = true;
+          runningEmpties.clear();
+        } else if (size_t top = presentVal.prev(max_bitset::npos); top < rank) {
+          for (id_type peekId : runningPeeks[top]) linearized[peekId] = true;
+          runningPeeks[top].clear();
+        }
+        takeRunning(rank);
+        present[rank] = 1;
+        presentVal.set(rank);
+      }
+      for (id_type peekId : runningPeeks[rank]) linearized[peekId] = true;
+      runningPeeks[rank].clear();
+    };
+    auto linearizePoll = [&](id_type id) {
+      const uint32_t rank = rankOf[id];
+      linearizePeeks(rank);
+      --available[rank];
+      if (present[rank] == 0)
+        takeRunning(rank);
+      else if (--present[rank] == 0)
+        presentVal.reset(rank);
+      linearized[id] = true;
+    };
+    // Polls every present copy above `rank`, or every one if `rank` is `npos`
+    auto pullAbove = [&](size_t rank) {
+      for (size_t r = presentVal.prev(max_bitset::npos);
+           r != max_bitset::npos && (rank == max_bitset::npos || r > rank);
+           r = presentVal.prev(r)) {
+        auto& polls = runningPolls[r];
+        while (present[r] > 0) {
+          while (!polls.empty() && linearized[polls.front()]) {
+            std::pop_heap(polls.begin(), polls.end(), byDeadline);
+            polls.pop_back();
+          }
+          // A present copy without a running poll keeps its rank critical
+          if (polls.empty()) return false;
+          linearizePoll(polls.front());
         }
       }
+      return true;
+    };
+
+    for (; k < numEvents; ++k) {
+      const auto& [_, isInv, id] = events[k];
+      const uint32_t rank = rankOf[id];
+      if (isInv) {
+        if (isValuePoll(id)) {
+          runningPolls[rank].push_back(id);
+          std::push_heap(runningPolls[rank].begin(), runningPolls[rank].end(),
+                         byDeadline);
+        } else if (isValuePeek(id)) {
+          runningPeeks[rank].push_back(id);
+        } else if (hist[id].value != EMPTY_VALUE) {
+          ++available[rank];
+          runningInserts[rank].push_back(id);
+          std::push_heap(runningInserts[rank].begin(),
+                         runningInserts[rank].end(), byResponse);
+        } else {
+          runningEmpties.push_back(id);
+        }
+      } else if (!pqueue_traits::isAdd(hist[id].method)) {
+        if (!linearized[id]) return false;
+      } else if (hist[id].value != EMPTY_VALUE) {
+        if (!taken[id] && ++present[rank] == 1) presentVal.set(rank);
+      }
+
+      for (id_type dueId = valueDue[k]; dueId != NONE; dueId = nextDue[dueId]) {
+        if (linearized[dueId]) continue;
+        const uint32_t dueRank = rankOf[dueId];
+        if (available[dueRank] == 0 || !pullAbove(dueRank)) return false;
+        if (isValuePoll(dueId))
+          linearizePoll(dueId);
+        else
+          linearizePeeks(dueRank);
+      }
+
+      for (id_type emptyId = emptyDue[k]; emptyId != NONE;
+           emptyId = nextDue[emptyId]) {
+        if (linearized[emptyId]) continue;
+        if (!pullAbove(max_bitset::npos)) return false;
+        linearized[emptyId] = true;
+      }
     }
 
     return true;
   }
 };
 
-}  // namespace polylin
\ No newline at end of file
+}  // namespace polylin
@@ -1,8 +1,7 @@
 #pragma once
 
-#include <functional>
-#include <optional>
-#include <unordered_map>
+#include <cstdint>
+#include <limits>
 #include <vector>
 
 #include "base.hpp"
@@ -10,101 +9,122 @@
 namespace polylin {
 
 template <typename value_type>
-class QueueLin : public LinBase<value_type> {
+class QueueLin : public LinBase<value_type, queue_traits> {
   typedef Operation<value_type> oper_t;
   typedef History<value_type> hist_t;
+  typedef LinBase<value_type, queue_traits> base_t;
 
  public:
-  QueueLin() : LinBase<value_type>{{ENQ}, {DEQ}} {}
-
   // Assumption: at most one `ENQ`, valid queue operations.
-  // Time complexity: O(n log n)
-  bool distVal(hist_t& hist) {
-    if (!LinBase<value_type>::preprocess(hist)) return false;
-
-    std::unordered_map<value_type, size_t> opByVal;
-    std::vector<std::tuple<time_type, bool, oper_t>> enqEvents, otherEvents;
-    for (const oper_t& o : hist) {
-      ++opByVal[o.value];
-      if (o.method == Method::ENQ) {
-        enqEvents.emplace_back(o.startTime, true, o);
-        enqEvents.emplace_back(o.endTime, false, o);
-      } else {
-        otherEvents.emplace_back(o.startTime, true, o);
-        otherEvents.emplace_back(o.endTime, false, o);
-      }
+  // Time complexity: O(n log n), the sweep itself is linear over flat arrays
+  bool distVal(hist_t hist) {
+    history_index index;
+    if (!base_t::preprocess(hist, &index)) return false;
+    if (hist.empty()) return true;
+    // Events pack an index and a flag, in 32 bits unless the history is huge
+    if (2 * hist.size() < std::numeric_limits<uint32_t>::max())
+      return sweep<uint32_t>(hist, index);
+    return sweep<uint64_t>(hist, index);
+  }
+
+ private:
+  // Checks a preprocessed history with events packed in `word_type`, values
+  // numbered by the dense ids of `index`
+  template <typename word_type>
+  bool sweep(const hist_t& hist, const history_index& index) {
+    constexpr word_type NO_EVENT = std::numeric_limits<word_type>::max();
+
+    // Count operations per value
+    const std::vector<uint32_t>& valOf = index.valueOf;
+    std::vector<uint32_t> opByVal(index.numValues, 0);
+    time_type minTime = hist[0].startTime, maxTime = hist[0].endTime;
+    for (id_type i = 0; i < hist.size(); ++i) {
+      const oper_t& o = hist[i];
+      ++opByVal[valOf[i]];
+      minTime = std::min(minTime, o.startTime);
+      maxTime = std::max(maxTime, o.endTime);
+    }
+
+    // Times are distinct and compact after `tune`, so events are bucketed by
+    // time instead of sorted. Events are encoded as `(valId << 1) | isInv`.
+    std::vector<word_type> slots(maxTime - minTime + 1, NO_EVENT);
+    for (id_type i = 0; i < hist.size(); ++i) {
+      slots[hist[i].startTime - minTime] = (word_type{i} << 1) | 1;
+      slots[hist[i].endTime - minTime] = word_type{i} << 1;
+    }
+    std::vector<word_type> enqEvents, otherEvents;
+    enqEvents.reserve(hist.size());
+    otherEvents.reserve(hist.size());
+    for (const word_type& slot : slots) {
+      if (slot == NO_EVENT) continue;
+      id_type i = slot >> 1;
+      word_type e = (word_type{valOf[i]} << 1) | (slot & 1);
+      if (queue_traits::isAdd(hist[i].method))
+        enqEvents.push_back(e);
+      else
+        otherEvents.push_back(e);
     }
-    std::sort(enqEvents.begin(), enqEvents.end());
-    std::sort(otherEvents.begin(), otherEvents.end());
-
-    std::optional<value_type> lastInvVal;
-    std::unordered_set<value_type> pendingVals, confirmedVals;
-    std::unordered_map<value_type, size_t> runningOtherOp;
-
-    auto enqIter = enqEvents.rbegin();
-    std::function<void()> scanEnqEvents = [&]() {
-      while (enqIter != enqEvents.rend()) {
-        const auto& [_, isInv, op] = *enqIter;
-        if (confirmedVals.count(op.value)) {
-          ++enqIter;
-          continue;
-        }
 
-        if (isInv) break;
+    const uint32_t numVals = opByVal.size();
+    std::vector<uint8_t> state(numVals, NONE);
+    std::vector<uint32_t> runningOtherOp(numVals, 0);
+    uint32_t lastInvVal = NO_VAL;
 
-        if (pendingVals.count(op.value)) {
-          pendingVals.erase(op.value);
-          confirmedVals.insert(op.value);
-        } else {
-          pendingVals.insert(op.value);
-        }
+    auto advance = [&](uint32_t v) {
+      state[v] = state[v] == PENDING ? CONFIRMED : PENDING;
+    };
 
-        ++enqIter;
+    size_t enqIter = enqEvents.size();
+    auto scanEnqEvents = [&]() {
+      for (; enqIter > 0; --enqIter) {
+        word_type e = enqEvents[enqIter - 1];
+        if (state[e >> 1] == CONFIRMED) continue;
+        if (e & 1) break;
+        advance(e >> 1);
       }
     };
 
-    for (auto iter = otherEvents.rbegin(); iter != otherEvents.rend(); ++iter) {
-      const auto& [_, isInv, op] = *iter;
-      if (confirmedVals.count(op.value)) continue;
+    for (size_t k = otherEvents.size(); k-- > 0;) {
+      uint32_t v = otherEvents[k] >> 1;
+      bool isInv = otherEvents[k] & 1;
+      if (state[v] == CONFIRMED) continue;
 
       if (isInv) {
-        if (lastInvVal && lastInvVal != op.value) {
+        if (lastInvVal != NO_VAL && lastInvVal != v) {
           scanEnqEvents();
-          if (!confirmedVals.count(*lastInvVal) &&
-              !confirmedVals.count(op.value))
+          if (state[lastInvVal] != CONFIRMED && state[v] != CONFIRMED)
             return false;
 
-          if (!confirmedVals.count(op.value)) {
-            if (runningOtherOp[op.value] + 1 == opByVal[op.value]) return false;
+          if (state[v] != CONFIRMED) {
+            if (runningOtherOp[v] + 1 == opByVal[v]) return false;
 
-            lastInvVal = op.value;
-          } else if (confirmedVals.count(*lastInvVal))
-            lastInvVal.reset();
+            lastInvVal = v;
+          } else if (state[lastInvVal] == CONFIRMED)
+            lastInvVal = NO_VAL;
         } else {
-          lastInvVal = op.value;
+          lastInvVal = v;
 
-          if (runningOtherOp[op.value] + 1 == opByVal[op.value]) {
+          if (runningOtherOp[v] + 1 == opByVal[v]) {
             scanEnqEvents();
-            if (!confirmedVals.count(op.value)) return false;
+            if (state[v] != CONFIRMED) return false;
 
-            lastInvVal.reset();
+            lastInvVal = NO_VAL;
           }
         }
       } else {
-        ++runningOtherOp[op.value];
-        if (runningOtherOp[op.value] + 1 == opByVal[op.value]) {
-          if (pendingVals.count(op.value)) {
-            pendingVals.erase(op.value);
-            confirmedVals.insert(op.value);
-          } else {
-            pendingVals.insert(op.value);
-          }
-        }
+        if (++runningOtherOp[v] + 1 == opByVal[v]) advance(v);
       }
     }
 
     return true;
   }
+
+  static constexpr uint32_t NO_VAL = UINT32_MAX;
+
+  // Per value progress of the reverse sweep: a value is confirmed once the
+  // sweep has passed the response of its `ENQ` and the responses of all but
+  // one of its other operations
+  enum : uint8_t { NONE, PENDING, CONFIRMED };
 };
 
-}  // namespace polylin
\ No newline at end of file
+}  // namespace polylin
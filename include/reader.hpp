@@ -1,72 +1,342 @@
 #pragma once
 #include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#include <stdexcept>
+#include <string_view>
 #include <unordered_map>
 
 #include "definitions.hpp"
+#include "inflate.hpp"
+#include "stats.hpp"
 #include "util.hpp"
 
 namespace polylin {
 
+// Reads the whole file at `path` into `text`, reusing its capacity
+inline void readFile(const std::string& path, std::string& text) {
+  POLYLIN_STAT_SCOPE(STAT_READ);
+  std::ifstream f(path, std::ios::binary);
+  if (!f) throw std::runtime_error("Cannot open file: " + path);
+  f.seekg(0, std::ios::end);
+  text.resize(f.tellg());
+  f.seekg(0, std::ios::beg);
+  if (!f.read(text.data(), text.size()))
+    throw std::runtime_error("Cannot read file: " + path);
+}
+
+inline std::string readFile(const std::string& path) {
+  std::string text;
+  readFile(path, text);
+  return text;
+}
+
+// Histories of these data types carry return values
+inline bool hasRetVal(const std::string& type) { return type == "set"; }
+
+// Header of binary histories, followed by the data type name and the raw
+// operation records
+struct binary_header {
+  char magic[8];
+  uint32_t recordSize;
+  uint32_t valueSize;
+  uint32_t typeSize;
+  uint32_t flags;
+  uint64_t numOper;
+};
+
+inline constexpr char BINARY_MAGIC[8] = {'p', 'l', 'h', 'i', 's', 't', 0, 1};
+
+// Flag of binary histories whose records carry processes, without which
+// their processes are unset. Records without a process carry `NO_PROC`.
+inline constexpr uint32_t BINARY_PROCS = 1;
+
+inline bool isBinaryHistory(std::string_view text) {
+  return text.size() >= sizeof(binary_header) &&
+         std::memcmp(text.data(), BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+}
+
+inline binary_header readBinaryHeader(std::string_view text) {
+  binary_header header;
+  std::memcpy(&header, text.data(), sizeof(header));
+  if (text.size() - sizeof(header) < header.typeSize)
+    throw std::invalid_argument("Truncated binary history");
+  return header;
+}
+
+// Throws unless binary records are operations on `value_type`
 template <typename value_type>
-class HistoryReader {
- public:
-  HistoryReader(const std::string& path) : path(path) {}
+void checkBinaryRecords(const binary_header& header) {
+  if (header.recordSize != sizeof(Operation<value_type>) ||
+      header.valueSize != sizeof(value_type))
+    throw std::invalid_argument("Binary history of another value type");
+}
 
-  History<value_type> getHist() {
-    std::ifstream f(path);
-    std::string line;
-    History<value_type> hist;
-    while (std::getline(f, line)) {
-      std::stringstream ss{line};
-      line = trim(line);
-      if (line.empty() || line[0] == '#') continue;
+// Checks binary records from `begin` on, which are copied raw, and unsets
+// their processes unless they carry them
+template <typename value_type>
+void fixBinaryRecords(const binary_header& header, History<value_type>& hist,
+                      size_t begin) {
+  typedef Operation<value_type> oper_t;
+  for (size_t i = begin; i < hist.size(); ++i) {
+    // read as bytes, as out of range values are not valid enumerators or
+    // bools
+    const char* record = reinterpret_cast<const char*>(&hist[i]);
+    uint8_t method, retVal;
+    std::memcpy(&method, record + offsetof(oper_t, method), 1);
+    std::memcpy(&retVal, record + offsetof(oper_t, retVal), 1);
+    if (method >= methodNames.size() || retVal > 1)
+      throw std::invalid_argument("Malformed binary operation at index " +
+                                  std::to_string(i));
+    if (!(header.flags & BINARY_PROCS)) hist[i].proc = NO_PROC;
+  }
+}
+
+// Data type stated by the `# <type>` header of history text, empty if none
+inline std::string parseHistType(std::string_view text) {
+  if (isBinaryHistory(text)) {
+    binary_header header = readBinaryHeader(text);
+    return std::string(text.substr(sizeof(header), header.typeSize));
+  }
+  std::string_view line = text.substr(0, text.find('\n'));
+  if (line.empty() || line[0] != '#') return "";
+  return trim(std::string(line.substr(1)));
+}
+
+// Appends the operations of history text to `hist`, one per line as method,
+// value, return value if `withRetVal`, start time, end time and optionally
+// process. Empty lines and lines starting with `#` are skipped. Binary
+// histories always carry return values.
+template <typename value_type>
+void parseHistory(std::string_view text, bool withRetVal,
+                  History<value_type>& hist) {
+  POLYLIN_STAT_SCOPE(STAT_PARSE);
+  if (isBinaryHistory(text)) {
+    binary_header header = readBinaryHeader(text);
+    checkBinaryRecords<value_type>(header);
+    text.remove_prefix(sizeof(header) + header.typeSize);
+    if (text.size() / header.recordSize < header.numOper)
+      throw std::invalid_argument("Truncated binary history");
+    size_t size = hist.size();
+    hist.resize(size + header.numOper);
+    std::memcpy(hist.data() + size, text.data(),
+                header.numOper * header.recordSize);
+    fixBinaryRecords(header, hist, size);
+    return;
+  }
+
+  auto isSpace = [](char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+  };
 
-      std::string methodStr;
-      value_type value;
-      time_type startTime, endTime;
+  for (size_t pos = 0; pos < text.size();) {
+    size_t eol = std::min(text.find('\n', pos), text.size());
+    const char* const begin = text.data() + pos;
+    const char* const end = text.data() + eol;
+    const char* it = begin;
+    pos = eol + 1;
 
-      ss >> methodStr >> value >> startTime >> endTime;
+    auto skip = [&]() {
+      while (it != end && isSpace(*it)) ++it;
+    };
+    auto malformed = [&]() {
+      return std::invalid_argument("Malformed operation: " +
+                                   std::string(begin, end));
+    };
+    auto number = [&](auto& out) {
+      skip();
+      auto [next, ec] = std::from_chars(it, end, out);
+      if (ec != std::errc()) throw malformed();
+      it = next;
+    };
 
-      hist.emplace(getMethodFromStr(methodStr), value, startTime, endTime);
+    skip();
+    if (it == end || *it == '#') continue;
+    const char* word = it;
+    while (it != end && !isSpace(*it)) ++it;
+    Method method = getMethodFromStr({word, size_t(it - word)});
+
+    value_type value;
+    unsigned retVal = 1;
+    time_type startTime, endTime;
+    number(value);
+    if (withRetVal) number(retVal);
+    number(startTime);
+    number(endTime);
+    proc_type proc = NO_PROC;
+    skip();
+    if (it != end) {
+      number(proc);
+      // the last id stands for operations without a process
+      if (proc == NO_PROC) throw malformed();
     }
-    return hist;
+    hist.emplace_back(method, value, startTime, endTime, retVal != 0, proc);
   }
+}
 
-  History<value_type> getExtHist() {
-    std::ifstream f(path);
-    std::string line;
-    History<value_type> hist;
-    while (std::getline(f, line)) {
-      std::stringstream ss{line};
-      line = trim(line);
-      if (line.empty() || line[0] == '#') continue;
+// Reads a history file in chunks, for histories too large to load whole.
+// Gzip-compressed files are inflated on a separate thread as they are read.
+template <typename value_type>
+class HistoryStream {
+ public:
+  explicit HistoryStream(const std::string& path) : input(path) {
+    std::string head(sizeof(header), '\0');
+    head.resize(input.read(head.data(), head.size()));
+    if (isBinaryHistory(head)) {
+      std::memcpy(&header, head.data(), sizeof(header));
+      checkBinaryRecords<value_type>(header);
+      head.resize(sizeof(header) + header.typeSize);
+      if (input.read(head.data() + sizeof(header), header.typeSize) !=
+          header.typeSize)
+        throw std::invalid_argument("Truncated binary history");
+      remaining = header.numOper;
+      binary = true;
+    } else {
+      // The rest of the first line, holding the type
+      char c;
+      while (head.find('\n') == std::string::npos && input.read(&c, 1))
+        head += c;
+      pending = head;
+    }
+    type = parseHistType(head);
+  }
 
-      std::string methodStr;
-      value_type value;
-      bool retVal;
-      time_type startTime, endTime;
+  const std::string& getHistTypeStr() const { return type; }
 
-      ss >> methodStr >> value >> retVal >> startTime >> endTime;
+  // Appends the operations of the next `chunkSize` bytes or so of the file
+  // to `hist`. Returns false once the file is exhausted.
+  bool read(History<value_type>& hist, size_t chunkSize) {
+    if (binary) {
+      if (!remaining) return false;
+      POLYLIN_STAT_SCOPE(STAT_READ);
+      size_t num = std::min<uint64_t>(
+          remaining, std::max<size_t>(chunkSize / sizeof(Operation<value_type>),
+                                      1));
+      size_t size = hist.size();
+      hist.resize(size + num);
+      const size_t bytes = num * sizeof(Operation<value_type>);
+      if (input.read(reinterpret_cast<char*>(hist.data() + size), bytes) !=
+          bytes)
+        throw std::invalid_argument("Truncated binary history");
+      fixBinaryRecords(header, hist, size);
+      remaining -= num;
+      return true;
+    }
 
-      hist.emplace(getMethodFromStr(methodStr), value, startTime, endTime,
-                   retVal);
+    if (ended && pending.empty()) return false;
+    size_t kept = pending.size();
+    {
+      POLYLIN_STAT_SCOPE(STAT_READ);
+      pending.resize(kept + chunkSize);
+      const size_t n = input.read(pending.data() + kept, chunkSize);
+      pending.resize(kept + n);
+      ended = n < chunkSize;
     }
-    return hist;
+    // Lines cut by the end of the chunk are parsed with the next one
+    size_t end = ended ? pending.size() : pending.rfind('\n') + 1;
+    parseHistory(std::string_view(pending).substr(0, end),
+                 hasRetVal(type), hist);
+    pending.erase(0, end);
+    return true;
   }
 
+ private:
+  InputFile input;
+  std::string type;
+  bool binary = false;
+  bool ended = false;
+  binary_header header{};
+  // Operations left in a binary history
+  uint64_t remaining = 0;
+  // Text read but not parsed yet
+  std::string pending;
+};
+
+// Identity of the bytes of a history in a result cache: their hash and
+// length, compressed ones if compressed, and the data type they hold
+struct content_key {
+  uint64_t hash;
+  uint64_t size;
+  std::string type;
+};
+
+// Key of the history of `bytes`, inflating only the head of gzip ones
+inline content_key contentKey(std::string_view bytes) {
+  // Compressed bytes inflated for the type, which leads the history
+  constexpr size_t HEAD_SIZE = 4096;
+  std::string head;
+  std::string_view text = bytes;
+  if (compressionOf(bytes) == compression::gzip) {
+    GzipInflater inflater;
+    inflater.feed(bytes.substr(0, HEAD_SIZE), head);
+    text = head;
+  }
+  return {contentHash(bytes), bytes.size(), parseHistType(text)};
+}
+
+// Reads a history file whole. Gzip-compressed files are parsed in chunks as
+// they are inflated instead, and their operations can only be read once.
+template <typename value_type>
+class HistoryReader {
+  // Bytes of compressed histories parsed at a time
+  static constexpr size_t CHUNK_SIZE = size_t{1} << 20;
+
+ public:
+  HistoryReader(const std::string& path) : path(path) {}
+
+  History<value_type> getHist() { return parse(false); }
+
+  History<value_type> getExtHist() { return parse(true); }
+
   std::string getHistTypeStr() {
-    std::ifstream f(path);
-    std::string line;
-    if (!std::getline(f, line) || line[0] != '#') return "";
+    load();
+    return stream ? stream->getHistTypeStr() : parseHistType(text);
+  }
 
-    return trim(line.substr(1));
+  // Cache key of the bytes of the file, compressed ones if compressed
+  content_key getContentKey() {
+    load();
+    return contentKey(stream ? readFile(path) : text);
   }
 
  private:
+  void load() {
+    if (loaded) return;
+    loaded = true;
+    switch (fileCompression(path)) {
+      case compression::none:
+        text = readFile(path);
+        break;
+      case compression::gzip:
+        stream = std::make_unique<HistoryStream<value_type>>(path);
+        break;
+      case compression::zstd:
+        unsupportedZstd();
+    }
+  }
+
+  // Compressed histories are parsed with or without return values by their
+  // type rather than `withRetVal`
+  History<value_type> parse(bool withRetVal) {
+    load();
+    History<value_type> hist;
+    if (stream)
+      while (stream->read(hist, CHUNK_SIZE)) {
+      }
+    else
+      parseHistory(text, withRetVal, hist);
+    return hist;
+  }
+
   const std::string path;
+  std::string text;
+  std::unique_ptr<HistoryStream<value_type>> stream;
+  bool loaded = false;
 };
 
-}  // namespace polylin
\ No newline at end of file
+}  // namespace polylin
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include "definitions.hpp"
+#include "reader.hpp"
+
+namespace polylin {
+
+#if defined(__x86_64__)
+// Whether the TSC runs at a constant rate, synchronized across cores
+inline bool hasInvariantTsc() {
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+  return edx & (1u << 8);
+}
+
+inline const bool useTsc = hasInvariantTsc();
+#endif
+
+// Timestamp for recorded operations, read without touching shared memory.
+// Uses the invariant TSC where available and `CLOCK_MONOTONIC_RAW` otherwise.
+// The fence makes preceding stores visible first, so that an operation's
+// effects precede its response time, and `rdtscp`/`lfence` keep the read in
+// place among the surrounding instructions. Only the order of timestamps is
+// meaningful.
+inline time_type recorderNow() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+#if defined(__x86_64__)
+  if (useTsc) {
+    unsigned aux;
+    time_type t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+  }
+#endif
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return time_type(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Writes `hist` as history text under a `# <type>` header, with a process
+// column for operations that have one
+template <typename value_type>
+void writeHistory(std::ostream& out, const std::string& type,
+                  const History<value_type>& hist) {
+  const bool withRetVal = hasRetVal(type);
+  std::string buf = "# " + type + "\n";
+  char num[24];
+  auto field = [&](auto value) {
+    buf += ' ';
+    buf.append(num, std::to_chars(num, num + sizeof(num), value).ptr);
+  };
+  for (const auto& o : hist) {
+    buf += methodNames[o.method];
+    field(o.value);
+    if (withRetVal) field(int(o.retVal));
+    field(o.startTime);
+    field(o.endTime);
+    if (o.proc != NO_PROC) field(o.proc);
+    buf += '\n';
+    if (buf.size() >= (1 << 16)) {
+      out.write(buf.data(), buf.size());
+      buf.clear();
+    }
+  }
+  out.write(buf.data(), buf.size());
+}
+
+// Writes `hist` in the binary format read by `parseHistory`
+template <typename value_type>
+void writeBinaryHistory(std::ostream& out, const std::string& type,
+                        const History<value_type>& hist) {
+  binary_header header{};
+  std::memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+  header.recordSize = sizeof(Operation<value_type>);
+  header.valueSize = sizeof(value_type);
+  header.typeSize = type.size();
+  header.flags = BINARY_PROCS;
+  header.numOper = hist.size();
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(type.data(), type.size());
+  out.write(reinterpret_cast<const char*>(hist.data()),
+            hist.size() * sizeof(Operation<value_type>));
+}
+
+// Records the operations of a fixed set of threads on the system under test.
+// Each thread appends to a buffer of its own on a separate cache line, so
+// recording neither locks nor shares writes between threads. Buffers are
+// merged into a history once the threads are done.
+template <typename value_type>
+class Recorder {
+ public:
+  class alignas(64) ThreadLog {
+   public:
+    void append(Method method, value_type value, time_type startTime,
+                time_type endTime, bool retVal = true) {
+      ops.emplace_back(method, value, startTime, endTime, retVal);
+    }
+
+    // Appends an operation started at `startTime` and responding now
+    void complete(Method method, value_type value, time_type startTime,
+                  bool retVal = true) {
+      append(method, value, startTime, recorderNow(), retVal);
+    }
+
+   private:
+    friend class Recorder;
+    History<value_type> ops;
+  };
+
+  // Reserves `capacity` operations per thread so that recording does not
+  // reallocate
+  Recorder(std::string type, size_t numThreads, size_t capacity = 0)
+      : type(std::move(type)), logs(numThreads) {
+    for (ThreadLog& log : logs) log.ops.reserve(capacity);
+  }
+
+  static time_type now() { return recorderNow(); }
+
+  // Buffer of thread `tid`, to be appended to by that thread only
+  ThreadLog& thread(size_t tid) { return logs[tid]; }
+
+  const std::string& histType() const { return type; }
+
+  // Operations of all threads, with times rebased to start from 0 and
+  // threads as processes
+  History<value_type> merge() const {
+    size_t size = 0;
+    time_type minTime = std::numeric_limits<time_type>::max();
+    for (const ThreadLog& log : logs) {
+      size += log.ops.size();
+      for (const auto& o : log.ops) minTime = std::min(minTime, o.startTime);
+    }
+
+    History<value_type> hist;
+    hist.reserve(size);
+    for (size_t tid = 0; tid < logs.size(); ++tid)
+      for (auto o : logs[tid].ops) {
+        o.startTime -= minTime;
+        o.endTime -= minTime;
+        o.proc = tid < NO_PROC ? tid : NO_PROC;
+        hist.push_back(o);
+      }
+    return hist;
+  }
+
+  void writeText(std::ostream& out) const {
+    writeHistory(out, type, merge());
+  }
+
+  void writeBinary(std::ostream& out) const {
+    writeBinaryHistory(out, type, merge());
+  }
+
+ private:
+  const std::string type;
+  std::vector<ThreadLog> logs;
+};
+
+}  // namespace polylin
@@ -0,0 +1,479 @@
+#pragma once
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "check.hpp"
+#include "reader.hpp"
+
+// Checking server listening on a Unix domain socket, sparing frequent
+// callers the startup of a process per history. Every request is a line,
+// answered by a line:
+//
+//   CHECK <flags> PATH <path>         checks the history file at `path`
+//   CHECK <flags> INLINE <bytes>      checks the history of the next `bytes`
+//   STATS                             latency stats of the server as JSON
+//
+// where flags are `-` or any of `i` (incremental) and `t` (timed). Checks
+// are answered by `OK ` and the output of `polylin` with these flags, or by
+// `ERROR ` and the reason. A connection may send any number of requests.
+// Inline histories above `MAX_INLINE_SIZE` and request lines above
+// `MAX_LINE_SIZE` are refused, closing the connection. The socket is only
+// accessible to the user of the server, as checks read any file the server
+// can and errors quote their content.
+namespace polylin {
+
+namespace server_detail {
+
+// Recent latencies kept for percentiles
+constexpr size_t RECENT_LATENCIES = size_t{1} << 16;
+// Largest inline history accepted, in bytes
+constexpr size_t MAX_INLINE_SIZE = size_t{1} << 30;
+// Longest request line accepted, in bytes
+constexpr size_t MAX_LINE_SIZE = size_t{1} << 16;
+
+class Connection;
+
+// Request taken whole off a connection, with the history of an inline check
+// or the reason it is refused
+struct request {
+  Connection* conn;
+  std::string line, text, error;
+};
+
+// Size of the history following `line` if it is an inline check, checks of
+// larger histories being refused before their history is read
+inline size_t inlineSize(const std::string& line) {
+  std::istringstream in{line};
+  std::string verb, flags, source;
+  size_t size;
+  if (in >> verb >> flags >> source >> size && verb == "CHECK" &&
+      source == "INLINE" && size <= MAX_INLINE_SIZE)
+    return size;
+  return 0;
+}
+
+// Buffered reads and writes of a connected socket. Reads never block, so
+// that requests are framed by a single thread however slowly clients send
+// them.
+class Connection {
+ public:
+  explicit Connection(int fd) : fd(fd) {}
+  ~Connection() { close(fd); }
+
+  Connection(const Connection&) = delete;
+  Connection& operator=(const Connection&) = delete;
+
+  // Buffers what the socket has, up to a bound per call so that a client
+  // streaming data does not hold up the others. Returns false once the
+  // stream ended.
+  bool receive() {
+    char chunk[1 << 16];
+    for (int reads = 0; reads < 16; ++reads) {
+      ssize_t n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+      if (n > 0) {
+        buffer.append(chunk, n);
+      } else if (n == 0) {
+        ended = true;
+        break;
+      } else if (errno != EINTR) {
+        ended = errno != EAGAIN && errno != EWOULDBLOCK;
+        break;
+      }
+    }
+    return !ended;
+  }
+
+  // Takes the next whole request off the buffer into `req`, returns false if
+  // it has not been received whole yet
+  bool takeRequest(request& req) {
+    const size_t eol = buffer.find('\n', pos);
+    if (eol == std::string::npos) {
+      if (buffer.size() - pos <= MAX_LINE_SIZE) return false;
+      req = {this, {}, {}, "Request line too long"};
+      pos = buffer.size();
+      return true;
+    }
+    std::string line(buffer, pos, eol - pos);
+    const size_t size = inlineSize(line);
+    if (buffer.size() - eol - 1 < size) return false;
+    req = {this, std::move(line), buffer.substr(eol + 1, size), {}};
+    pos = eol + 1 + size;
+    if (pos == buffer.size()) {
+      buffer.clear();
+      pos = 0;
+    }
+    return true;
+  }
+
+  // Whether the client closed its end, after which no request can follow
+  // those buffered
+  bool hasEnded() const { return ended; }
+
+  int socket() const { return fd; }
+
+  void write(std::string_view data) {
+    while (!data.empty()) {
+      ssize_t n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0)
+        throw std::runtime_error(std::string("Cannot write to socket: ") +
+                                 std::strerror(errno));
+      data.remove_prefix(n);
+    }
+  }
+
+  // Reads the next line into `line`, blocking, returns false at the end of
+  // the stream. Only for clients, see `requestServer`.
+  bool readLine(std::string& line) {
+    size_t eol;
+    while ((eol = buffer.find('\n', pos)) == std::string::npos)
+      if (!fill()) return false;
+    line.assign(buffer, pos, eol - pos);
+    pos = eol + 1;
+    return true;
+  }
+
+ private:
+  bool fill() {
+    buffer.erase(0, pos);
+    pos = 0;
+    char chunk[1 << 16];
+    ssize_t n;
+    while ((n = recv(fd, chunk, sizeof(chunk), 0)) < 0 && errno == EINTR) {
+    }
+    if (n <= 0) return false;
+    buffer.append(chunk, n);
+    return true;
+  }
+
+  const int fd;
+  std::string buffer;
+  size_t pos = 0;
+  bool ended = false;
+};
+
+// Address of the Unix domain socket at `path`
+inline sockaddr_un socketAddress(const std::string& path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    throw std::invalid_argument("Socket path too long: " + path);
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return addr;
+}
+
+// Request and response latencies, in seconds
+class LatencyStats {
+ public:
+  void add(double secs, bool error) {
+    std::scoped_lock lock{mutex};
+    if (recent.size() < RECENT_LATENCIES)
+      recent.push_back(secs);
+    else
+      recent[count % RECENT_LATENCIES] = secs;
+    ++count;
+    errors += error;
+    sum += secs;
+    max = std::max(max, secs);
+  }
+
+  // Writes the stats as JSON on a single line, percentiles over the recent
+  // requests
+  void writeJson(std::ostream& out) {
+    std::vector<double> sorted;
+    {
+      std::scoped_lock lock{mutex};
+      out << "{\"requests\": " << count << ", \"errors\": " << errors
+          << ", \"mean_seconds\": " << (count ? sum / count : 0)
+          << ", \"max_seconds\": " << max;
+      sorted = recent;
+    }
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) {
+      return sorted.empty() ? 0 : sorted[size_t(p * (sorted.size() - 1))];
+    };
+    out << ", \"p50_seconds\": " << percentile(0.5)
+        << ", \"p99_seconds\": " << percentile(0.99) << "}";
+  }
+
+ private:
+  std::mutex mutex;
+  std::vector<double> recent;
+  uint64_t count = 0, errors = 0;
+  double sum = 0, max = 0;
+};
+
+}  // namespace server_detail
+
+// Serves checks on the Unix domain socket at `path` with `numThreads`
+// workers, until interrupted or terminated. The accepting thread polls the
+// idle connections and queues their requests for the workers once received
+// whole, so that idle connections and slow clients hold no worker. Workers
+// serve a request at a time, reusing their monitors and text buffers across
+// requests.
+template <typename value_type>
+void runServer(const std::string& path, size_t numThreads, std::ostream& log) {
+  using namespace server_detail;
+  typedef std::chrono::steady_clock clock;
+  typedef std::unordered_map<std::string,
+                             std::unique_ptr<Monitor<value_type>>>
+      monitor_map;
+
+  // Signals are taken by the accepting thread only, for a clean shutdown
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  int signalFd = signalfd(-1, &signals, SFD_CLOEXEC);
+  // Written by workers handing connections back to the accepting thread
+  int wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_un addr = socketAddress(path);
+  unlink(path.c_str());
+  // Restricted to the user before listening, so that no other can connect
+  if (signalFd < 0 || wakeFd < 0 || listenFd < 0 ||
+      bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      chmod(path.c_str(), S_IRUSR | S_IWUSR) < 0 ||
+      listen(listenFd, SOMAXCONN) < 0)
+    throw std::runtime_error("Cannot listen on " + path + ": " +
+                             std::strerror(errno));
+
+  std::mutex mutex;
+  std::condition_variable workerCv;
+  // Open connections by socket, requests queued for the workers, and
+  // connections handed back to be polled again
+  std::unordered_map<int, std::unique_ptr<Connection>> connections;
+  std::deque<request> ready;
+  std::vector<Connection*> handedBack;
+  bool serving = true;
+  LatencyStats latencies;
+
+  // Serves `req`, returns false if its connection must be closed
+  auto serve = [&](const request& req, std::string& text,
+                   std::string& inflated, monitor_map& monitors) {
+    Connection& conn = *req.conn;
+    const std::string& line = req.line;
+    const clock::time_point received = clock::now();
+    if (line == "STATS") {
+      std::ostringstream json;
+      latencies.writeJson(json);
+      conn.write(json.str() + '\n');
+      return true;
+    }
+
+    std::string response;
+    bool open = req.error.empty();
+    try {
+      if (!open) throw std::invalid_argument(req.error);
+      std::istringstream in{line};
+      std::string verb, flags, source;
+      in >> verb >> flags >> source;
+      if (verb != "CHECK" ||
+          flags.find_first_not_of(flags == "-" ? "-" : "it") !=
+              std::string::npos)
+        throw std::invalid_argument("Malformed request: " + line);
+      std::string_view raw;
+      if (source == "PATH") {
+        std::string file;
+        std::getline(in >> std::ws, file);
+        readFile(file, text);
+        raw = text;
+      } else if (source == "INLINE") {
+        size_t size;
+        if (!(in >> size))
+          throw std::invalid_argument("Malformed request: " + line);
+        // the history left unread cannot be told from the next request
+        open = size <= MAX_INLINE_SIZE;
+        if (!open)
+          throw std::invalid_argument("Inline history too large: " +
+                                      std::to_string(size) + " bytes");
+        raw = req.text;
+      } else {
+        throw std::invalid_argument("Malformed request: " + line);
+      }
+
+      const bool incremental = flags.find('i') != std::string::npos;
+      std::string_view hist_text = decompressed(raw, inflated);
+      std::string type = parseHistType(hist_text);
+      std::unique_ptr<Monitor<value_type>>& monitor = monitors[type];
+      if (!monitor) monitor = getMonitor<value_type>(type);
+      History<value_type> hist;
+      hist.reserve(std::count(hist_text.begin(), hist_text.end(), '\n') + 1);
+      parseHistory(hist_text, hasRetVal(type), hist);
+
+      double secs;
+      check_result result =
+          checkHistory(*monitor, std::move(hist), incremental, secs);
+      response = "OK " +
+                 formatResult(result, incremental,
+                              flags.find('t') != std::string::npos, secs);
+    } catch (const std::exception& e) {
+      response = std::string("ERROR ") + e.what();
+    }
+    std::replace(response.begin(), response.end(), '\n', ' ');
+    conn.write(response + '\n');
+    latencies.add(
+        std::chrono::duration<double>(clock::now() - received).count(),
+        response[0] == 'E');
+    return open;
+  };
+
+  auto work = [&]() {
+    monitor_map monitors;
+    std::string text, inflated;
+    for (;;) {
+      request req;
+      {
+        std::unique_lock lock{mutex};
+        workerCv.wait(lock, [&]() { return !ready.empty() || !serving; });
+        if (ready.empty()) return;
+        req = std::move(ready.front());
+        ready.pop_front();
+      }
+      bool open = false;
+      try {
+        open = serve(req, text, inflated, monitors);
+      } catch (const std::exception& e) {
+        std::scoped_lock lock{mutex};
+        log << e.what() << std::endl;
+      }
+      // Requests already buffered are taken by the accepting thread
+      std::scoped_lock lock{mutex};
+      if (!open) {
+        connections.erase(req.conn->socket());
+      } else {
+        handedBack.push_back(req.conn);
+        const uint64_t one = 1;
+        ssize_t n = ::write(wakeFd, &one, sizeof(one));
+        (void)n;
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < std::max<size_t>(numThreads, 1); ++i)
+    workers.emplace_back(work);
+
+  // Connections waiting for the rest of a request
+  std::vector<Connection*> idle;
+  std::vector<pollfd> fds;
+  for (;;) {
+    fds = {{listenFd, POLLIN, 0}, {signalFd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+    for (Connection* conn : idle) fds.push_back({conn->socket(), POLLIN, 0});
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (fds[1].revents) break;
+
+    // Idle connections are only touched by this thread, which receives
+    // without the lock. Hangups and errors end their stream.
+    std::vector<Connection*> received, waiting;
+    for (size_t k = 3; k < fds.size(); ++k) {
+      Connection* conn = idle[k - 3];
+      if (fds[k].revents) {
+        conn->receive();
+        received.push_back(conn);
+      } else {
+        waiting.push_back(conn);
+      }
+    }
+    if (fds[2].revents) {
+      uint64_t count;
+      ssize_t n = read(wakeFd, &count, sizeof(count));
+      (void)n;
+    }
+
+    bool queued = false;
+    {
+      std::scoped_lock lock{mutex};
+      received.insert(received.end(), handedBack.begin(), handedBack.end());
+      handedBack.clear();
+      if (fds[0].revents & POLLIN) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd >= 0)
+          waiting.push_back(
+              connections.emplace(fd, std::make_unique<Connection>(fd))
+                  .first->second.get());
+      }
+      // Requests received whole are queued, a connection at a time
+      for (Connection* conn : received) {
+        request req;
+        if (conn->takeRequest(req)) {
+          ready.push_back(std::move(req));
+          queued = true;
+        } else if (conn->hasEnded()) {
+          connections.erase(conn->socket());
+        } else {
+          waiting.push_back(conn);
+        }
+      }
+    }
+    if (queued) workerCv.notify_all();
+    idle = std::move(waiting);
+  }
+
+  close(listenFd);
+  unlink(path.c_str());
+  {
+    // Connections being served are shut down to end their writes
+    std::scoped_lock lock{mutex};
+    serving = false;
+    ready.clear();
+    for (const auto& [fd, conn] : connections) shutdown(fd, SHUT_RDWR);
+  }
+  workerCv.notify_all();
+  for (std::thread& worker : workers) worker.join();
+  connections.clear();
+  close(wakeFd);
+  close(signalFd);
+  latencies.writeJson(log);
+  log << std::endl;
+}
+
+// Sends `request` to the server at `path` and returns its response line,
+// or nothing if the server cannot be reached
+inline std::optional<std::string> requestServer(const std::string& path,
+                                                const std::string& request) {
+  using namespace server_detail;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return std::nullopt;
+  Connection conn{fd};
+  sockaddr_un addr = socketAddress(path);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+    return std::nullopt;
+  std::string response;
+  conn.write(request + '\n');
+  if (!conn.readLine(response))
+    throw std::runtime_error("Connection closed by server: " + path);
+  return response;
+}
+
+}  // namespace polylin
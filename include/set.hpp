@@ -1,57 +1,489 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #include "base.hpp"
 
 namespace polylin {
 
 template <typename value_type>
-class SetLin : public LinBase<value_type> {
+class SetLin : public LinBase<value_type, set_traits> {
   typedef Operation<value_type> oper_t;
   typedef History<value_type> hist_t;
+  typedef LinBase<value_type, set_traits> base_t;
 
  public:
-  SetLin() : LinBase<value_type>{{INSERT}, {REMOVE}} {}
+  // Assumption: valid set operations, keys may be inserted and removed any
+  // number of times. Sets are checked key by key, each key being a sequence of
+  // epochs delimited by its successful inserts and removes. Keys are checked
+  // by a greedy schedule, and those it rejects by an exact search over the
+  // states of the key.
+  // Time complexity: O(n log n) when the greedy schedules every key, the
+  // search being exponential in the operations running at once on a key in
+  // the worst case
+  bool distVal(hist_t hist) {
+    // Gaps are numbered up to twice the operations, in 32 bits
+    base_t::checkSize(hist, NO_GAP / 2);
+    base_t::validate(hist);
+    if (hist.empty()) return true;
 
-  // Assumption: at most one `INSERT`, valid priority queue operations.
-  // Time complexity: O(n)
-  bool distVal(hist_t& hist) {
-    hist_t hist2;
-    for (oper_t o : hist) {
-      if (o.method == INSERT && o.retVal == false) {
-        o.method = CONTAINS;
-        o.retVal = true;
-      } else if (o.method == REMOVE && o.retVal == false) {
-        o.method = CONTAINS;
-      }
-      hist2.emplace(std::move(o));
+    // Operations take effect in a gap between events, gap `k` preceding
+    // event `k`, so that every operation spans the gaps [lo, hi]. Events are
+    // ordered by merging the invocations and the responses, responses first
+    // at equal times.
+    const size_t n = hist.size();
+    const std::vector<uint32_t> invOrder =
+        orderBy(hist, [](const oper_t& o) { return o.startTime; });
+    const std::vector<uint32_t> resOrder =
+        orderBy(hist, [](const oper_t& o) { return o.endTime; });
+
+    // Operations are checked through columns laid out key by key in
+    // invocation order, so that each key reads contiguous memory
+    std::vector<uint32_t> keyOf(n), keyStart;
+    groupKeys(hist, keyOf, keyStart);
+    std::vector<uint32_t> posOf(n), fill(keyStart);
+    for (uint32_t id : invOrder) posOf[id] = fill[keyOf[id]]++;
+
+    std::vector<uint32_t> lo(n), hi(n);
+    for (uint32_t i = 0, j = 0, k = 0; i < n || j < n;) {
+      if (j < n && (i == n || hist[resOrder[j]].endTime <=
+                                  hist[invOrder[i]].startTime))
+        hi[posOf[resOrder[j++]]] = k++;
+      else
+        lo[posOf[invOrder[i++]]] = ++k;
+    }
+    bool inverted = false;
+    for (size_t pos = 0; pos < n; ++pos) inverted |= hi[pos] < lo[pos];
+    if (inverted) return false;
+
+    std::vector<role> roles(n);
+    for (id_type i = 0; i < n; ++i) roles[posOf[i]] = roleOf(hist[i]);
+
+    epoch_params params{lo, hi, roles};
+    params.used.resize(n);
+    for (uint32_t key = 0; key + 1 < keyStart.size(); ++key)
+      if (keyStart[key] != keyStart[key + 1] &&
+          !distValKey(params, keyStart[key], keyStart[key + 1]))
+        return false;
+    return true;
+  }
+
+  // Sets are not preprocessed, which leaves no use for the index of the
+  // sub-history
+  bool distValAt(SubHistView<value_type>& view, time_type time) {
+    return distVal(view.at(time, nullptr));
+  }
+
+ private:
+  // Released transitions of a kind, earliest deadline on top
+  struct deadline_heap {
+    const std::vector<uint32_t>& hi;
+    std::vector<id_type> ids{};
+
+    bool empty() const { return ids.empty(); }
+    id_type top() const { return ids.front(); }
+
+    void push(id_type id) {
+      ids.push_back(id);
+      std::push_heap(ids.begin(), ids.end(), later());
+    }
+
+    void pop() {
+      std::pop_heap(ids.begin(), ids.end(), later());
+      ids.pop_back();
+    }
+
+    auto later() const {
+      return [this](id_type a, id_type b) { return hi[a] > hi[b]; };
     }
+  };
+
+  // Roles of operations on their key. Successful inserts and removes are
+  // transitions, others observe the key present or absent.
+  enum role : uint8_t { ABSENT, PRESENT, INSERTED, REMOVED };
 
-    if (!LinBase<value_type>::extend(hist2)) return false;
+  static role roleOf(const oper_t& o) {
+    if (o.method == CONTAINS) return o.retVal ? PRESENT : ABSENT;
+    if (set_traits::isAdd(o.method)) return o.retVal ? INSERTED : PRESENT;
+    return o.retVal ? REMOVED : ABSENT;
+  }
+
+  // Scratch buffers are reused across keys, operations being identified by
+  // their position in the columns
+  struct epoch_params {
+    const std::vector<uint32_t>& lo;
+    const std::vector<uint32_t>& hi;
+    const std::vector<role>& roles;
+    std::vector<id_type> adds{}, removes{}, observers{}, deferred{};
+    std::vector<id_type> addsByDeadline{}, removesByDeadline{};
+    std::vector<bool> used{};
+    std::vector<uint32_t> loBound{}, hiBound{}, earliest{}, latest{};
+    deadline_heap releasedAdds{hi}, releasedRemoves{hi};
+  };
 
-    std::unordered_map<value_type, time_type> minRes, maxInv;
-    for (const oper_t& o : hist2) {
-      if (o.retVal) {
-        minRes[o.value] = minRes.count(o.value)
-                              ? std::min(minRes[o.value], o.endTime)
-                              : o.endTime;
-        maxInv[o.value] = maxInv.count(o.value)
-                              ? std::max(maxInv[o.value], o.startTime)
-                              : o.startTime;
+  // Indices of `hist` ordered by `time`, ties broken by index. Times and
+  // indices are packed into single words when they fit, sorting much faster
+  // than comparisons through the history.
+  template <typename time_fn>
+  static std::vector<uint32_t> orderBy(const hist_t& hist, time_fn time) {
+    const size_t n = hist.size();
+    time_type minTime = time(hist[0]), maxTime = minTime;
+    for (const oper_t& o : hist) {
+      minTime = std::min(minTime, time(o));
+      maxTime = std::max(maxTime, time(o));
+    }
+    std::vector<uint32_t> order(n);
+    const int idBits = std::bit_width(n);
+    if (std::bit_width(maxTime - minTime) + idBits <= 64) {
+      std::vector<uint64_t> keys(n);
+      for (id_type i = 0; i < n; ++i)
+        keys[i] = (time(hist[i]) - minTime) << idBits | i;
+      std::sort(keys.begin(), keys.end());
+      const uint64_t idMask = (uint64_t{1} << idBits) - 1;
+      for (size_t k = 0; k < n; ++k) order[k] = keys[k] & idMask;
+    } else {
+      std::iota(order.begin(), order.end(), 0);
+      std::stable_sort(order.begin(), order.end(), [&](id_type a, id_type b) {
+        return time(hist[a]) < time(hist[b]);
+      });
+    }
+    return order;
+  }
+
+  // Dense key ids of the operations of `hist`, and the offsets of each key
+  // in a key-major layout. Integer keys spanning a range not much larger
+  // than the history are their own ids, others are interned.
+  static void groupKeys(const hist_t& hist, std::vector<uint32_t>& keyOf,
+                        std::vector<uint32_t>& keyStart) {
+    if constexpr (std::is_integral_v<value_type>) {
+      value_type minKey = hist[0].value, maxKey = hist[0].value;
+      for (const oper_t& o : hist) {
+        minKey = std::min(minKey, o.value);
+        maxKey = std::max(maxKey, o.value);
       }
+      const uint64_t range = uint64_t(maxKey) - uint64_t(minKey);
+      if (range < 2 * uint64_t(hist.size()) + 64) {
+        keyStart.assign(range + 2, 0);
+        for (id_type i = 0; i < hist.size(); ++i)
+          ++keyStart[keyOf[i] = uint64_t(hist[i].value) - uint64_t(minKey)];
+        toOffsets(keyStart);
+        return;
+      }
+    }
+    std::unordered_map<value_type, uint32_t> keyIds;
+    keyIds.reserve(hist.size());
+    for (id_type i = 0; i < hist.size(); ++i) {
+      auto [iter, inserted] =
+          keyIds.try_emplace(hist[i].value, keyStart.size());
+      if (inserted) keyStart.push_back(0);
+      ++keyStart[iter->second];
+      keyOf[i] = iter->second;
+    }
+    keyStart.push_back(0);
+    toOffsets(keyStart);
+  }
+
+  // Turns counts into exclusive prefix sums
+  static void toOffsets(std::vector<uint32_t>& counts) {
+    for (uint32_t key = 0, sum = 0; key < counts.size(); ++key)
+      sum += std::exchange(counts[key], sum);
+  }
+
+  static constexpr uint32_t NO_GAP = std::numeric_limits<uint32_t>::max();
+  static constexpr size_t NO_EPOCH = std::numeric_limits<size_t>::max();
+  static constexpr size_t PLACED = NO_EPOCH - 1;
+
+  // Checks the operations of a key, given in invocation order. Successful
+  // inserts and removes, the transitions, alternate starting with an insert.
+  // Transitions are ordered by earliest deadline among released ones, unless
+  // an unreleased one would miss its deadline before the next transition of
+  // its kind. The key is present in the epochs following odd transitions.
+  // Observers are placed in an epoch of their result, tightening the bounds
+  // of the transitions around it. The greedy order of the transitions may
+  // miss a schedule, so that its rejections are confirmed by `searchKey`.
+  static bool distValKey(epoch_params& p, uint32_t begin, uint32_t end) {
+    return greedyKey(p, begin, end) ||
+           (!p.adds.empty() && searchKey(p, begin, end));
+  }
+
+  // Schedules the transitions of a key greedily, see `distValKey`
+  static bool greedyKey(epoch_params& p, uint32_t begin, uint32_t end) {
+    p.adds.clear();
+    p.removes.clear();
+    p.observers.clear();
+    for (uint32_t pos = begin; pos < end; ++pos) {
+      if (p.roles[pos] == INSERTED)
+        p.adds.push_back(pos);
+      else if (p.roles[pos] == REMOVED)
+        p.removes.push_back(pos);
+      else
+        p.observers.push_back(pos);
     }
+    if (p.removes.size() > p.adds.size() ||
+        p.adds.size() > p.removes.size() + 1)
+      return false;
+
+    // Transitions are 1-indexed, bounds and gaps are padded by sentinels so
+    // that every epoch `g` in [0, numTrans] lies between `g` and `g + 1`
+    const size_t numTrans = p.adds.size() + p.removes.size();
+    p.loBound.assign(numTrans + 2, 0);
+    p.hiBound.assign(numTrans + 2, NO_GAP);
+    p.earliest.assign(numTrans + 2, 0);
+    p.latest.assign(numTrans + 2, NO_GAP);
+
+    p.addsByDeadline.assign(p.adds.begin(), p.adds.end());
+    p.removesByDeadline.assign(p.removes.begin(), p.removes.end());
+    for (auto* ops : {&p.addsByDeadline, &p.removesByDeadline})
+      std::sort(ops->begin(), ops->end(),
+                [&](id_type a, id_type b) { return p.hi[a] < p.hi[b]; });
+
+    p.releasedAdds.ids.clear();
+    p.releasedRemoves.ids.clear();
+    size_t addIter = 0, removeIter = 0, addUrgent = 0, removeUrgent = 0;
+    uint32_t gap = 0;
+    for (size_t t = 1; t <= numTrans; ++t) {
+      const bool isAdd = t & 1;
+      const std::vector<id_type>& ops = isAdd ? p.adds : p.removes;
+      const std::vector<id_type>& others = isAdd ? p.removes : p.adds;
+      const std::vector<id_type>& urgentOps =
+          isAdd ? p.addsByDeadline : p.removesByDeadline;
+      size_t& iter = isAdd ? addIter : removeIter;
+      size_t& urgent = isAdd ? addUrgent : removeUrgent;
+      deadline_heap& released = isAdd ? p.releasedAdds : p.releasedRemoves;
+      deadline_heap& othersReleased =
+          isAdd ? p.releasedRemoves : p.releasedAdds;
+      size_t othersIter = isAdd ? removeIter : addIter;
 
-    for (const oper_t& o : hist2) {
-      if (o.retVal) {
-        if (o.method == INSERT && o.startTime > minRes[o.value]) return false;
-        if (o.method == REMOVE && o.endTime < maxInv[o.value]) return false;
+      while (!released.empty() && p.used[released.top()]) released.pop();
+      if (released.empty()) {
+        while (p.used[ops[iter]]) ++iter;
+        gap = std::max(gap, p.lo[ops[iter]]);
+      }
+      for (; iter < ops.size() && p.lo[ops[iter]] <= gap; ++iter)
+        if (!p.used[ops[iter]]) released.push(ops[iter]);
+      while (!released.empty() && p.used[released.top()]) released.pop();
+
+      // The next transition of this kind follows one of the other kind
+      uint32_t next = gap;
+      while (!othersReleased.empty() && p.used[othersReleased.top()])
+        othersReleased.pop();
+      while (othersIter < others.size() && p.used[others[othersIter]])
+        ++othersIter;
+      if (othersReleased.empty() && othersIter < others.size())
+        next = std::max(gap, p.lo[others[othersIter]]);
+      while (p.used[urgentOps[urgent]]) ++urgent;
+      id_type id = urgentOps[urgent];
+      if (p.lo[id] > gap && p.hi[id] < next) {
+        gap = p.lo[id];
       } else {
-        if (minRes[o.value] < o.startTime && o.endTime < maxInv[o.value])
-          return false;
+        id = released.top();
+        released.pop();
+      }
+      p.used[id] = true;
+
+      if (p.hi[id] < gap) return false;
+      p.loBound[t] = p.lo[id];
+      p.hiBound[t] = p.hi[id];
+      p.earliest[t] = gap;
+    }
+    p.earliest[numTrans + 1] = NO_GAP;
+    p.latest[0] = 0;
+    for (size_t t = numTrans; t >= 1; --t)
+      p.latest[t] = std::min(p.hiBound[t], p.latest[t + 1]);
+
+    // Epochs of parity `parity` in [first, last], or none if `first > last`
+    auto alignUp = [](size_t g, size_t parity) {
+      return g + ((g ^ parity) & 1);
+    };
+    auto alignDown = [](size_t g, size_t parity) {
+      return g == 0 && parity ? NO_EPOCH : g - ((g ^ parity) & 1);
+    };
+    auto firstAtLeast = [&](const std::vector<uint32_t>& gaps, uint32_t gap) {
+      return std::lower_bound(gaps.begin() + 1, gaps.end(), gap) -
+             gaps.begin() - 1;
+    };
+    auto lastAtMost = [&](const std::vector<uint32_t>& gaps, uint32_t gap) {
+      return std::upper_bound(gaps.begin(), gaps.end() - 1, gap) -
+             gaps.begin() - 1;
+    };
+
+    // Places the observer in epoch `g`, which requires transition `g` to
+    // precede its response and transition `g + 1` to follow its invocation
+    auto place = [&](id_type id, size_t g) {
+      if (p.hiBound[g] > p.hi[id]) {
+        p.hiBound[g] = p.hi[id];
+        for (size_t t = g; t >= 1; --t) {
+          uint32_t latest = std::min(p.hiBound[t], p.latest[t + 1]);
+          if (latest == p.latest[t]) break;
+          if (latest < p.earliest[t]) return false;
+          p.latest[t] = latest;
+        }
       }
+      if (p.loBound[g + 1] < p.lo[id]) {
+        p.loBound[g + 1] = p.lo[id];
+        for (size_t t = g + 1; t <= numTrans; ++t) {
+          uint32_t earliest = std::max(p.loBound[t], p.earliest[t - 1]);
+          if (earliest == p.earliest[t]) break;
+          if (earliest > p.latest[t]) return false;
+          p.earliest[t] = earliest;
+        }
+      }
+      return true;
+    };
+
+    // Places the observer in an epoch that needs no tightening, or in its
+    // only candidate epoch. Returns `PLACED` on success, `NO_EPOCH` if that
+    // fails, or the first candidate epoch if there are several.
+    auto tryPlace = [&](id_type id) -> size_t {
+      const size_t parity = p.roles[id] == PRESENT;
+      size_t first = alignUp(firstAtLeast(p.latest, p.lo[id]), parity);
+      size_t last = alignDown(lastAtMost(p.earliest, p.hi[id]), parity);
+      if (last == NO_EPOCH || first > last) return NO_EPOCH;
+      size_t freeFirst = alignUp(firstAtLeast(p.earliest, p.lo[id]), parity);
+      size_t freeLast = alignDown(lastAtMost(p.latest, p.hi[id]), parity);
+      if (freeLast != NO_EPOCH && freeFirst <= freeLast) return PLACED;
+      if (first == last) return place(id, first) ? PLACED : NO_EPOCH;
+      return first;
+    };
+
+    p.deferred.clear();
+    for (id_type id : p.observers) {
+      size_t g = tryPlace(id);
+      if (g == NO_EPOCH) return false;
+      if (g != PLACED) p.deferred.push_back(id);
+    }
+    for (id_type id : p.deferred) {
+      size_t g = tryPlace(id);
+      if (g == NO_EPOCH || (g != PLACED && !place(id, g))) return false;
     }
+    return true;
+  }
 
+  // State of a key in a gap: whether it is present, and its running
+  // transitions not linearized yet, earliest deadline first
+  struct key_state {
+    bool present;
+    std::vector<id_type> adds, removes;
+
+    bool operator<(const key_state& other) const {
+      return std::tie(present, adds, removes) <
+             std::tie(other.present, other.adds, other.removes);
+    }
+  };
+
+  // Checks the operations of a key exactly. Transitions are linearized only
+  // in the gaps preceding responses, as deferring them to such a gap lets
+  // them observe no less, and a transition of a kind is the running one due
+  // first. A gap takes as few transitions as meet the deadlines, or one
+  // more, further pairs being deferred to the next gap at no loss. Every
+  // state reached in such a gap is kept once, with the earliest deadline of
+  // its running observers that have not seen their result yet, the latest
+  // over the ways to reach it. The key takes both values in a gap with
+  // transitions, which every running observer sees. States are dropped if
+  // another with as many transitions left can do whatever they can, its
+  // transitions of each kind and its observers being due no earlier.
+  static bool searchKey(const epoch_params& p, uint32_t begin, uint32_t end) {
+    std::vector<uint32_t> gaps(p.hi.begin() + begin, p.hi.begin() + end);
+    std::sort(gaps.begin(), gaps.end());
+    gaps.erase(std::unique(gaps.begin(), gaps.end()), gaps.end());
+
+    auto earlier = [&](id_type a, id_type b) {
+      return std::pair(p.hi[a], a) < std::pair(p.hi[b], b);
+    };
+    auto due = [&](const std::vector<id_type>& ops) {
+      return ops.empty() ? NO_GAP : p.hi[ops.front()];
+    };
+    auto dueNoEarlier = [&](const std::vector<id_type>& ops,
+                            const std::vector<id_type>& others) {
+      for (size_t i = 0; i < ops.size(); ++i)
+        if (p.hi[ops[i]] < p.hi[others[i]]) return false;
+      return true;
+    };
+    typedef std::pair<key_state, uint32_t> reached_state;
+    auto covers = [&](const reached_state& a, const reached_state& b) {
+      return a.second >= b.second &&
+             dueNoEarlier(a.first.adds, b.first.adds) &&
+             dueNoEarlier(a.first.removes, b.first.removes);
+    };
+    auto counts = [](const reached_state& a) {
+      return std::tuple(a.first.present, a.first.adds.size(),
+                        a.first.removes.size());
+    };
+
+    std::vector<reached_state> states{{key_state{false, {}, {}}, NO_GAP}};
+    std::map<key_state, uint32_t> next;
+    uint32_t invoked = begin;
+    for (uint32_t gap : gaps) {
+      const uint32_t first = invoked;
+      while (invoked < end && p.lo[invoked] <= gap) ++invoked;
+      next.clear();
+      for (const auto& [reached, reachedDeadline] : states) {
+        key_state state = reached;
+        uint32_t deadline = reachedDeadline;
+        for (uint32_t pos = first; pos < invoked; ++pos) {
+          if (p.roles[pos] == INSERTED || p.roles[pos] == REMOVED) {
+            auto& ops = p.roles[pos] == INSERTED ? state.adds : state.removes;
+            ops.insert(std::upper_bound(ops.begin(), ops.end(), pos, earlier),
+                       pos);
+          } else if ((p.roles[pos] == PRESENT) != state.present) {
+            deadline = std::min(deadline, p.hi[pos]);
+          }
+        }
+        for (int flips = 0, valid = 0; valid < 2; ++flips) {
+          if (flips) deadline = NO_GAP;
+          if (valid || (deadline > gap && due(state.adds) > gap &&
+                        due(state.removes) > gap)) {
+            auto [iter, inserted] = next.try_emplace(state, deadline);
+            if (!inserted) iter->second = std::max(iter->second, deadline);
+            ++valid;
+          }
+          auto& ops = state.present ? state.removes : state.adds;
+          if (ops.empty()) break;
+          ops.erase(ops.begin());
+          state.present = !state.present;
+        }
+      }
+      if (next.empty()) return false;
+
+      states.assign(next.begin(), next.end());
+      std::stable_sort(states.begin(), states.end(),
+                       [&](const reached_state& a, const reached_state& b) {
+                         return counts(a) < counts(b);
+                       });
+      auto kept = states.begin();
+      for (auto group = states.begin(); group != states.end();) {
+        auto groupEnd = group;
+        while (groupEnd != states.end() && counts(*groupEnd) == counts(*group))
+          ++groupEnd;
+        const auto groupKept = kept;
+        for (auto it = group; it != groupEnd; ++it) {
+          if (std::any_of(groupKept, kept, [&](const reached_state& other) {
+                return covers(other, *it);
+              }))
+            continue;
+          kept = std::remove_if(groupKept, kept,
+                                [&](const reached_state& other) {
+                                  return covers(*it, other);
+                                });
+          if (kept != it) *kept = std::move(*it);
+          ++kept;
+        }
+        group = groupEnd;
+      }
+      states.erase(kept, states.end());
+    }
     return true;
   }
 };
 
-}  // namespace polylin
\ No newline at end of file
+}  // namespace polylin
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <queue>
 #include <unordered_map>
 #include <vector>
@@ -12,28 +14,40 @@
 namespace polylin {
 
 template <typename value_type>
-class StackLin : public LinBase<value_type> {
+class StackLin : public LinBase<value_type, stack_traits> {
   typedef Operation<value_type> oper_t;
   typedef History<value_type> hist_t;
+  typedef LinBase<value_type, stack_traits> base_t;
 
  public:
-  StackLin() : LinBase<value_type>{{PUSH}, {POP}} {}
-
   // Assumption: at most one `PUSH`, valid stack operations.
   // Time complexity: O(n log n)
-  bool distVal(hist_t& hist) {
-    std::unordered_map<value_type, interval> critIntervalByVal;
-    if (!LinBase<value_type>::preprocess(hist)) return false;
+  bool distVal(hist_t hist) {
+    if (!base_t::preprocess(hist)) return false;
+    // Flushed times lie in [0, 2n), positions reach 4n with sentinels
+    if (4 * hist.size() <= std::numeric_limits<int32_t>::max())
+      return distValIndexed<int32_t>(std::move(hist));
+    return distValIndexed<int64_t>(std::move(hist));
+  }
 
+ private:
+  // Checks a preprocessed history with times and positions of `index_type`.
+  // Values are summed in 64 bits whatever the index width.
+  template <typename index_type>
+  bool distValIndexed(hist_t hist) {
+    typedef interval<index_type> interval_t;
+    typedef interval_tree<index_type> interval_tree_t;
+    std::unordered_map<value_type, interval_t> critIntervalByVal;
     flush(hist, critIntervalByVal);
     if (hist.empty()) return true;
     size_t n = hist.size();
 
-    std::unordered_map<time_type, value_type> startTimeToVal;
-    interval_tree ops;
-    std::unordered_map<value_type, interval_tree> opByVal;
-    segment_tree critIntervals{2 * n - 1};   // +1 per value
-    segment_tree critIntervals2{2 * n - 1};  // +i per value i
+    std::vector<value_type> startTimeToVal(2 * n);
+    interval_tree_t ops;
+    std::unordered_map<value_type, interval_tree_t> opByVal;
+    segment_tree<index_type> critIntervals{2 * n - 1};  // +1 per value
+    // +i per value i
+    segment_tree<index_type, int64_t> critIntervals2{2 * n - 1};
 
     for (const auto& [value, intvl] : critIntervalByVal) {
       critIntervals.update_range(intvl.start, intvl.end - 1, 1);
@@ -41,16 +55,16 @@ class StackLin : public LinBase<value_type> {
     }
     for (const oper_t& o : hist) {
       startTimeToVal[o.startTime] = o.value;
-      ops.insert({o.startTime, o.endTime});
-      opByVal[o.value].insert({o.startTime, o.endTime});
+      ops.insert(interval_t(o.startTime, o.endTime));
+      opByVal[o.value].insert(interval_t(o.startTime, o.endTime));
     }
 
     std::unordered_map<value_type, std::vector<time_type>> pointsByLastVal;
     std::unordered_set<value_type> clearedVals;
 
     // remove intervals overlapping [point, point + 1]
-    auto removeOverlap = [&](interval_tree& intervals, const int& point) {
-      for (const interval& intvl : intervals.query(point)) {
+    auto removeOverlap = [&](interval_tree_t& intervals, index_type point) {
+      for (const interval_t& intvl : intervals.query(point)) {
         if (intvl.end == point) continue;
         ops.remove(intvl);
         value_type val = startTimeToVal[intvl.start];
@@ -61,9 +75,9 @@ class StackLin : public LinBase<value_type> {
 
     while (!ops.empty()) {
       // find empty points, clear overlapping oper_ts
-      std::pair<int, int> pr = critIntervals.query_min();
+      std::pair<index_type, index_type> pr = critIntervals.query_min();
       while (pr.first == 0) {
-        time_type pos = pr.second;
+        index_type pos = pr.second;
         removeOverlap(ops, pos);
         critIntervals.update_range(pos, pos, 2 * n);  // 2*n is a sentinel value
         pr = critIntervals.query_min();
@@ -71,7 +85,7 @@ class StackLin : public LinBase<value_type> {
 
       // find single layer interval points and value, clear overlapping oper_ts
       while (pr.first == 1) {
-        time_type pos = pr.second;
+        index_type pos = pr.second;
         value_type val = critIntervals2.query_val(pos);
         removeOverlap(opByVal[val], pos);
         critIntervals.update_range(pos, pos, 2 * n);  // 2*n is a sentinel value
@@ -95,56 +109,47 @@ class StackLin : public LinBase<value_type> {
     return true;
   }
 
- private:
   // flush timings one more time and remove concurrent push and pop
+  template <typename interval_t>
   void flush(hist_t& hist,
-             std::unordered_map<value_type, interval>& critIntervalByVal) {
-    std::vector<std::tuple<time_type, bool, oper_t>> events;
-    for (const oper_t& o : hist) {
-      events.emplace_back(o.startTime, true, o);
-      events.emplace_back(o.endTime, false, o);
-    }
-    std::sort(events.begin(), events.end());
-    hist.clear();
+             std::unordered_map<value_type, interval_t>& critIntervalByVal) {
+    POLYLIN_STAT_SCOPE(STAT_STACK_FLUSH);
+    std::vector<event> events = getEvents(hist);
 
     std::unordered_set<value_type> removableVals;
-    std::queue<oper_t> opQueue;
-    for (const auto& [_, isInv, oldOp] : events) {
-      oper_t op{oldOp};
-      // Add padding to values so that min value is 1
-      ++op.value;
+    for (const auto& [_, isInv, id] : events) {
+      const oper_t& op = hist[id];
       if (isInv) {
-        if (op.method == POP) removableVals.erase(oldOp.value);
-        opQueue.emplace(op);
+        if (stack_traits::isRemove(op.method)) removableVals.erase(op.value);
       } else {
-        if (op.method == PUSH) removableVals.insert(oldOp.value);
-        opQueue.emplace(op);
+        if (stack_traits::isAdd(op.method)) removableVals.insert(op.value);
       }
     }
 
+    // Add padding to values so that min value is 1
+    hist_t flushed;
     time_type time = MIN_TIME;
-    std::unordered_set<oper_t> ongoingOps;
-    while (!opQueue.empty()) {
-      if (removableVals.count(opQueue.front().value)) {
-        opQueue.pop();
-        continue;
-      }
+    std::vector<bool> ongoingOps(hist.size());
+    for (const auto& [_, isInv, id] : events) {
+      oper_t& op = hist[id];
+      if (removableVals.count(op.value)) continue;
 
-      if (!ongoingOps.count(opQueue.front())) {
-        oper_t op{opQueue.front()};
+      if (!ongoingOps[id]) {
         op.startTime = time;
-        if (op.method == POP) critIntervalByVal[op.value].end = time;
-        ongoingOps.emplace(op);
+        if (stack_traits::isRemove(op.method))
+          critIntervalByVal[op.value + 1].end = time;
+        ongoingOps[id] = true;
       } else {
-        oper_t op{*ongoingOps.find(opQueue.front())};
         op.endTime = time;
-        if (op.method == PUSH) critIntervalByVal[op.value].start = time;
-        hist.emplace(op);
+        if (stack_traits::isAdd(op.method))
+          critIntervalByVal[op.value + 1].start = time;
+        flushed.push_back(op);
+        ++flushed.back().value;
       }
 
-      opQueue.pop();
       ++time;
     }
+    std::swap(hist, flushed);
   }
 };
 
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#ifdef POLYLIN_STATS
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#endif
+
+// Phase timings and counters of the checker. Built with `POLYLIN_STATS`, the
+// probes below record once enabled at runtime; built without, they expand to
+// nothing.
+namespace polylin {
+
+enum stat_id : uint8_t {
+  // timed phases
+  STAT_READ,
+  STAT_PARSE,
+  STAT_EXTEND,
+  STAT_TUNE,
+  STAT_REMOVE_EMPTY,
+  STAT_STACK_FLUSH,
+  STAT_CHECK,
+  STAT_BISECT,
+  STAT_EXTERNAL_SORT,
+  STAT_INFLATE,
+  // counters
+  STAT_SEGMENT_TREE_OPS,
+  STAT_INTERVAL_TREE_OPS,
+  STAT_DEQUE_STATES,
+  STAT_BISECT_PROBES,
+  STAT_EXTERNAL_RUNS,
+  STAT_EXTERNAL_SEGMENTS,
+  NUM_STATS
+};
+
+// Stats before this one are timed phases
+inline constexpr stat_id FIRST_COUNTER = STAT_SEGMENT_TREE_OPS;
+
+// Stat names indexed by `stat_id`
+inline constexpr std::array<std::string_view, NUM_STATS> statNames{
+    "read",
+    "parse",
+    "extend",
+    "tune",
+    "remove_empty",
+    "stack_flush",
+    "check",
+    "bisect",
+    "external_sort",
+    "inflate",
+    "segment_tree_ops",
+    "interval_tree_ops",
+    "deque_states",
+    "bisect_probes",
+    "external_runs",
+    "external_segments"};
+
+#ifdef POLYLIN_STATS
+
+namespace stats {
+
+struct stat_block {
+  uint64_t count[NUM_STATS] = {};
+  uint64_t nanos[NUM_STATS] = {};
+
+  void add(const stat_block& other) {
+    for (size_t i = 0; i < NUM_STATS; ++i) {
+      count[i] += other.count[i];
+      nanos[i] += other.nanos[i];
+    }
+  }
+};
+
+inline std::atomic<bool> enabled{false};
+inline std::atomic<uint64_t> allocations{0}, allocatedBytes{0};
+
+// Stats of exited threads
+inline std::mutex retiredMutex;
+inline stat_block retired;
+
+// Stats of the calling thread, merged into `retired` on exit
+struct thread_block : stat_block {
+  ~thread_block() {
+    std::scoped_lock lock{retiredMutex};
+    retired.add(*this);
+  }
+};
+
+inline thread_local thread_block local;
+
+inline bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+inline void count(stat_id id, uint64_t n = 1) {
+  if (isEnabled()) local.count[id] += n;
+}
+
+// Called by the replaced global `operator new` of executables
+inline void countAllocation(size_t size) {
+  if (!isEnabled()) return;
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+class scope_timer {
+  typedef std::chrono::steady_clock clock;
+
+ public:
+  explicit scope_timer(stat_id id) : id(id), on(isEnabled()) {
+    if (on) start = clock::now();
+  }
+
+  ~scope_timer() {
+    if (!on) return;
+    ++local.count[id];
+    local.nanos[id] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           clock::now() - start)
+                           .count();
+  }
+
+  scope_timer(const scope_timer&) = delete;
+  scope_timer& operator=(const scope_timer&) = delete;
+
+ private:
+  const stat_id id;
+  const bool on;
+  clock::time_point start;
+};
+
+// Peak resident set size of the process in kB, -1 if unknown
+inline long peakRssKb() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line))
+    if (line.rfind("VmHWM:", 0) == 0) return std::stol(line.substr(6));
+  return -1;
+}
+
+// Writes the stats of exited threads and the calling one as JSON
+inline void writeJson(std::ostream& out) {
+  stat_block total;
+  {
+    std::scoped_lock lock{retiredMutex};
+    total = retired;
+  }
+  total.add(local);
+
+  out << "{\n  \"phases\": {";
+  for (size_t i = 0; i < FIRST_COUNTER; ++i)
+    out << (i ? ",\n" : "\n") << "    \"" << statNames[i]
+        << "\": {\"calls\": " << total.count[i]
+        << ", \"seconds\": " << total.nanos[i] / 1e9 << "}";
+  out << "\n  },\n  \"counters\": {";
+  for (size_t i = FIRST_COUNTER; i < NUM_STATS; ++i)
+    out << (i != FIRST_COUNTER ? ",\n" : "\n") << "    \"" << statNames[i]
+        << "\": " << total.count[i];
+  out << "\n  },\n  \"allocations\": {\"count\": " << allocations.load()
+      << ", \"bytes\": " << allocatedBytes.load() << "},\n"
+      << "  \"peak_rss_kb\": " << peakRssKb() << "\n}" << std::endl;
+}
+
+}  // namespace stats
+
+#define POLYLIN_STAT_CONCAT_(a, b) a##b
+#define POLYLIN_STAT_CONCAT(a, b) POLYLIN_STAT_CONCAT_(a, b)
+#define POLYLIN_STAT_SCOPE(id) \
+  ::polylin::stats::scope_timer POLYLIN_STAT_CONCAT(statScope, __LINE__)(id)
+#define POLYLIN_STAT_COUNT(id, n) ::polylin::stats::count(id, n)
+
+#else
+
+#define POLYLIN_STAT_SCOPE(id) static_cast<void>(0)
+#define POLYLIN_STAT_COUNT(id, n) static_cast<void>(0)
+
+#endif
+
+}  // namespace polylin
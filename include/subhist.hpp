@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+#include "definitions.hpp"
+
+namespace polylin {
+
+// Sub-histories of a history cut at given times, for the incremental search
+template <typename value_type>
+class SubHistView {
+ public:
+  virtual ~SubHistView() = default;
+
+  // Keeps operations ended by `time` and running ones on values of ended
+  // ones, then fabricates a remove for every successful add left unmatched.
+  // Fills `index` with the sorted events and value ids of the sub-history if
+  // given.
+  virtual History<value_type> at(time_type time, history_index* index) = 0;
+};
+
+// Sub-histories of a history sorted once by end time, so that the operations
+// ended by a cut time are a prefix of it. A sub-history then costs a copy of
+// that prefix, a scan of the operations started by the cut time and the
+// fabricated removes, rather than hashing every operation of the history.
+// Its events are filtered from those of the history, sorted once as well.
+template <typename value_type, typename traits>
+class PrefixView : public SubHistView<value_type> {
+  typedef Operation<value_type> oper_t;
+  typedef History<value_type> hist_t;
+
+  static constexpr uint32_t NO_POS = std::numeric_limits<uint32_t>::max();
+
+ public:
+  explicit PrefixView(hist_t hist) : byEnd(std::move(hist)) {
+    std::stable_sort(byEnd.begin(), byEnd.end(),
+                     [](const oper_t& a, const oper_t& b) {
+                       return a.endTime < b.endTime;
+                     });
+    byStart.resize(byEnd.size());
+    std::iota(byStart.begin(), byStart.end(), 0);
+    std::stable_sort(byStart.begin(), byStart.end(),
+                     [&](uint32_t a, uint32_t b) {
+                       return byEnd[a].startTime < byEnd[b].startTime;
+                     });
+
+    // Dense ids of non-empty values, with the first end time of each
+    std::unordered_map<value_type, uint32_t> ids;
+    valueOf.resize(byEnd.size(), NO_VALUE);
+    for (size_t i = 0; i < byEnd.size(); ++i) {
+      const oper_t& o = byEnd[i];
+      if (o.value == EMPTY_VALUE) continue;
+      auto [iter, inserted] = ids.try_emplace(o.value, values.size());
+      if (inserted) {
+        values.push_back(o.value);
+        firstEnd.push_back(o.endTime);
+      }
+      valueOf[i] = iter->second;
+    }
+    balance.resize(values.size());
+    events = getEvents(byEnd);
+    posOf.resize(byEnd.size(), NO_POS);
+  }
+
+  hist_t at(time_type time, history_index* index) override {
+    const size_t cut =
+        std::upper_bound(byEnd.begin(), byEnd.end(), time,
+                         [](time_type t, const oper_t& o) {
+                           return t < o.endTime;
+                         }) -
+        byEnd.begin();
+
+    // Running operations kept, in the order of `byEnd`
+    running.clear();
+    for (uint32_t i : byStart) {
+      const oper_t& o = byEnd[i];
+      if (o.startTime >= time) break;
+      if (i >= cut && valueOf[i] != NO_VALUE && firstEnd[valueOf[i]] <= time)
+        running.push_back(i);
+    }
+    std::sort(running.begin(), running.end());
+
+    hist_t subhist;
+    subhist.reserve(cut + running.size());
+    subhist.assign(byEnd.begin(), byEnd.begin() + cut);
+    for (size_t i = 0; i < cut; ++i) count(i);
+    for (uint32_t i : running) {
+      posOf[i] = subhist.size();
+      subhist.push_back(byEnd[i]);
+      subhist.back().endTime = time + 3;
+      count(i);
+    }
+    const id_type numKept = subhist.size();
+    if (index) {
+      index->valueOf.assign(valueOf.begin(), valueOf.begin() + cut);
+      for (uint32_t i : running) index->valueOf.push_back(valueOf[i]);
+      index->numValues = values.size();
+    }
+
+    for (uint32_t id : touched) {
+      for (int64_t i = 0; i < balance[id]; ++i) {
+        subhist.emplace_back(traits::defaultRemoveMethod, values[id],
+                             time + 1, time + 2);
+        if (index) index->valueOf.push_back(id);
+      }
+      balance[id] = 0;
+    }
+    touched.clear();
+
+    if (index) {
+      // Events up to `time` of kept operations keep their order, followed by
+      // the fabricated removes and the responses of running operations
+      std::vector<event>& subEvents = index->events;
+      subEvents.clear();
+      subEvents.reserve(2 * subhist.size());
+      for (const auto& [t, isInv, i] : events) {
+        if (t > time) break;
+        id_type pos = i < cut ? i : posOf[i];
+        if (pos != NO_POS) subEvents.push_back({t, isInv, pos});
+      }
+      for (id_type pos = numKept; pos < subhist.size(); ++pos)
+        subEvents.push_back({time + 1, true, pos});
+      for (id_type pos = numKept; pos < subhist.size(); ++pos)
+        subEvents.push_back({time + 2, false, pos});
+      for (id_type pos = cut; pos < numKept; ++pos)
+        subEvents.push_back({time + 3, false, pos});
+    }
+    for (uint32_t i : running) posOf[i] = NO_POS;
+    return subhist;
+  }
+
+ private:
+  // Counts the operation at `i` in the balance of adds and removes of its
+  // value
+  void count(size_t i) {
+    const oper_t& o = byEnd[i];
+    if (valueOf[i] == NO_VALUE || !o.retVal) return;
+    int64_t& b = balance[valueOf[i]];
+    if (traits::isAdd(o.method)) {
+      if (!b++) touched.push_back(valueOf[i]);
+    } else if (traits::isRemove(o.method)) {
+      if (!b--) touched.push_back(valueOf[i]);
+    }
+  }
+
+  hist_t byEnd;
+  // Indices into `byEnd` by start time
+  std::vector<uint32_t> byStart;
+  // Value ids by index into `byEnd`
+  std::vector<uint32_t> valueOf;
+  // Values, and their first end times, by id
+  std::vector<value_type> values;
+  std::vector<time_type> firstEnd;
+  // Events of `byEnd`
+  std::vector<event> events;
+  // Scratch balances of the values touched by a sub-history
+  std::vector<int64_t> balance;
+  std::vector<uint32_t> touched;
+  // Scratch running operations kept by a sub-history, and their positions
+  // in it by index into `byEnd`
+  std::vector<uint32_t> running;
+  std::vector<uint32_t> posOf;
+};
+
+}  // namespace polylin
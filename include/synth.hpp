@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "definitions.hpp"
+
+namespace polylin {
+
+struct synth_params {
+  size_t numOper;
+  // Number of sequential processes, i.e. the expected overlap per operation
+  size_t numProc;
+  unsigned seed;
+  // Expected fraction of removes finding the container empty
+  double emptyRatio = 0;
+};
+
+// Schedules operations in linearization order over sequential processes,
+// every operation spanning its own linearization point
+class synth_scheduler {
+ public:
+  synth_scheduler(const synth_params& params)
+      : clocks(params.numProc, 0), width(params.numProc), rng(params.seed) {}
+
+  // Interval of the next operation in linearization order
+  std::pair<time_type, time_type> next() {
+    time_type& clock = clocks[rng() % clocks.size()];
+    lin = std::max(lin, clock) + 1;
+    time_type lead = std::min<time_type>(rng() % width, lin - 1);
+    time_type startTime = std::max(clock, lin - 1 - lead);
+    time_type endTime = lin + 1 + rng() % width;
+    clock = endTime;
+    return {startTime, endTime};
+  }
+
+  bool coin(double p) { return std::uniform_real_distribution<>{}(rng) < p; }
+
+  // Uniform integer in `[0, n)`
+  size_t roll(size_t n) { return rng() % n; }
+
+  std::mt19937_64& engine() { return rng; }
+
+ private:
+  std::vector<time_type> clocks;
+  time_type lin = 0;
+  time_type width;
+  std::mt19937_64 rng;
+};
+
+// Probability of adds among operations such that a fraction `emptyRatio` of
+// removes find the container empty, half of the operations if none do
+inline double addProb(const synth_params& params) {
+  return (1 - params.emptyRatio) / (2 - params.emptyRatio);
+}
+
+// Linearizable queue history with half the operations being `ENQ`, unless
+// `DEQ` outnumber them so that a fraction `emptyRatio` of `DEQ` are empty
+template <typename value_type>
+History<value_type> synthQueue(const synth_params& params) {
+  synth_scheduler scheduler{params};
+  History<value_type> hist;
+  hist.reserve(params.numOper);
+  std::deque<value_type> queue;
+  value_type nextVal = 0;
+  const double enqProb = addProb(params);
+  while (hist.size() < params.numOper) {
+    auto [startTime, endTime] = scheduler.next();
+    if ((queue.empty() && params.emptyRatio == 0) || scheduler.coin(enqProb)) {
+      hist.emplace_back(ENQ, nextVal, startTime, endTime);
+      queue.push_back(nextVal++);
+    } else if (queue.empty()) {
+      hist.emplace_back(DEQ, EMPTY_VALUE, startTime, endTime);
+    } else {
+      hist.emplace_back(DEQ, queue.front(), startTime, endTime);
+      queue.pop_front();
+    }
+  }
+  return hist;
+}
+
+// Linearizable stack history, shaped as `synthQueue`
+template <typename value_type>
+History<value_type> synthStack(const synth_params& params) {
+  synth_scheduler scheduler{params};
+  History<value_type> hist;
+  hist.reserve(params.numOper);
+  std::vector<value_type> stack;
+  value_type nextVal = 0;
+  const double pushProb = addProb(params);
+  while (hist.size() < params.numOper) {
+    auto [startTime, endTime] = scheduler.next();
+    if ((stack.empty() && params.emptyRatio == 0) || scheduler.coin(pushProb)) {
+      hist.emplace_back(PUSH, nextVal, startTime, endTime);
+      stack.push_back(nextVal++);
+    } else if (stack.empty()) {
+      hist.emplace_back(POP, EMPTY_VALUE, startTime, endTime);
+    } else {
+      hist.emplace_back(POP, stack.back(), startTime, endTime);
+      stack.pop_back();
+    }
+  }
+  return hist;
+}
+
+// Linearizable priority queue history, shaped as `synthQueue`, inserting
+// distinct priorities in random order
+template <typename value_type>
+History<value_type> synthPQueue(const synth_params& params) {
+  synth_scheduler scheduler{params};
+  History<value_type> hist;
+  hist.reserve(params.numOper);
+  std::vector<value_type> priorities(params.numOper);
+  std::iota(priorities.begin(), priorities.end(), 0);
+  std::shuffle(priorities.begin(), priorities.end(), scheduler.engine());
+  std::priority_queue<value_type> heap;
+  size_t nextVal = 0;
+  const double insertProb = addProb(params);
+  while (hist.size() < params.numOper) {
+    auto [startTime, endTime] = scheduler.next();
+    if ((heap.empty() && params.emptyRatio == 0) ||
+        scheduler.coin(insertProb)) {
+      hist.emplace_back(INSERT, priorities[nextVal], startTime, endTime);
+      heap.push(priorities[nextVal++]);
+    } else if (heap.empty()) {
+      hist.emplace_back(POLL, EMPTY_VALUE, startTime, endTime);
+    } else {
+      hist.emplace_back(POLL, heap.top(), startTime, endTime);
+      heap.pop();
+    }
+  }
+  return hist;
+}
+
+// Linearizable deque history, shaped as `synthQueue` with every operation on
+// a random end
+template <typename value_type>
+History<value_type> synthDeque(const synth_params& params) {
+  synth_scheduler scheduler{params};
+  History<value_type> hist;
+  hist.reserve(params.numOper);
+  std::deque<value_type> deque;
+  value_type nextVal = 0;
+  const double pushProb = addProb(params);
+  while (hist.size() < params.numOper) {
+    auto [startTime, endTime] = scheduler.next();
+    bool front = scheduler.coin(0.5);
+    if ((deque.empty() && params.emptyRatio == 0) || scheduler.coin(pushProb)) {
+      hist.emplace_back(front ? PUSH_FRONT : PUSH_BACK, nextVal, startTime,
+                        endTime);
+      if (front)
+        deque.push_front(nextVal++);
+      else
+        deque.push_back(nextVal++);
+    } else if (deque.empty()) {
+      hist.emplace_back(front ? POP_FRONT : POP_BACK, EMPTY_VALUE, startTime,
+                        endTime);
+    } else {
+      hist.emplace_back(front ? POP_FRONT : POP_BACK,
+                        front ? deque.front() : deque.back(), startTime,
+                        endTime);
+      if (front)
+        deque.pop_front();
+      else
+        deque.pop_back();
+    }
+  }
+  return hist;
+}
+
+// Linearizable set history of inserts, removes and contains in equal shares
+// over `numOper / 8` keys, each key seeing several insert and remove cycles
+template <typename value_type>
+History<value_type> synthSet(const synth_params& params) {
+  synth_scheduler scheduler{params};
+  History<value_type> hist;
+  hist.reserve(params.numOper);
+  const size_t numKeys = std::max<size_t>(params.numOper / 8, 1);
+  std::vector<bool> present(numKeys);
+  while (hist.size() < params.numOper) {
+    auto [startTime, endTime] = scheduler.next();
+    size_t key = scheduler.roll(numKeys);
+    switch (scheduler.roll(3)) {
+      case 0:
+        hist.emplace_back(INSERT, key, startTime, endTime, !present[key]);
+        present[key] = true;
+        break;
+      case 1:
+        hist.emplace_back(REMOVE, key, startTime, endTime, present[key]);
+        present[key] = false;
+        break;
+      default:
+        hist.emplace_back(CONTAINS, key, startTime, endTime, present[key]);
+    }
+  }
+  return hist;
+}
+
+// Linearizable history of the data type named `type`
+template <typename value_type>
+History<value_type> synthHistory(const std::string& type,
+                                 const synth_params& params) {
+  if (type == "stack") return synthStack<value_type>(params);
+  if (type == "queue") return synthQueue<value_type>(params);
+  if (type == "pqueue") return synthPQueue<value_type>(params);
+  if (type == "set") return synthSet<value_type>(params);
+  if (type == "deque") return synthDeque<value_type>(params);
+  throw std::invalid_argument("Unknown data type");
+}
+
+}  // namespace polylin
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+
+#include "definitions.hpp"
+
+namespace polylin {
+
+typedef uint32_t method_mask;
+
+constexpr method_mask methodBit(Method method) {
+  return method_mask{1} << method;
+}
+
+template <Method... methods>
+inline constexpr method_mask methodMask = (method_mask{0} | ... |
+                                           methodBit(methods));
+
+// Compile-time method classification of a data type. Monitors are templated
+// on their traits, so every query below folds into a single bit test against
+// a constant mask.
+template <method_mask addMask, method_mask removeMask, method_mask observeMask,
+          method_mask frontMask, method_mask emptyMask, Method defaultRemove>
+struct method_traits {
+  // Method used for fabricated removes of values never removed
+  static constexpr Method defaultRemoveMethod = defaultRemove;
+
+  static constexpr bool isAdd(Method method) {
+    return addMask & methodBit(method);
+  }
+
+  static constexpr bool isRemove(Method method) {
+    return removeMask & methodBit(method);
+  }
+
+  // Methods that neither add nor remove a value
+  static constexpr bool isObserve(Method method) {
+    return observeMask & methodBit(method);
+  }
+
+  // Methods acting on the front end of a two-ended container
+  static constexpr bool isFront(Method method) {
+    return frontMask & methodBit(method);
+  }
+
+  // Methods that may legally return `EMPTY_VALUE`
+  static constexpr bool canBeEmpty(Method method) {
+    return emptyMask & methodBit(method);
+  }
+
+  static constexpr bool supports(Method method) {
+    return (addMask | removeMask | observeMask) & methodBit(method);
+  }
+};
+
+typedef method_traits<methodMask<PUSH>, methodMask<POP>, methodMask<PEEK>, 0,
+                      methodMask<POP, PEEK>, POP>
+    stack_traits;
+
+typedef method_traits<methodMask<ENQ>, methodMask<DEQ>, 0, 0, methodMask<DEQ>,
+                      DEQ>
+    queue_traits;
+
+typedef method_traits<methodMask<INSERT>, methodMask<POLL>, methodMask<PEEK>,
+                      0, methodMask<POLL, PEEK>, POLL>
+    pqueue_traits;
+
+typedef method_traits<methodMask<INSERT>, methodMask<REMOVE>,
+                      methodMask<CONTAINS>, 0, 0, REMOVE>
+    set_traits;
+
+typedef method_traits<
+    methodMask<PUSH_FRONT, PUSH_BACK>, methodMask<POP_FRONT, POP_BACK>,
+    methodMask<PEEK_FRONT, PEEK_BACK>,
+    methodMask<PUSH_FRONT, POP_FRONT, PEEK_FRONT>,
+    methodMask<POP_FRONT, POP_BACK, PEEK_FRONT, PEEK_BACK>, POP_BACK>
+    deque_traits;
+
+}  // namespace polylin
@@ -1,11 +1,15 @@
 #pragma once
+#include <bit>
+#include <cstdint>
+#include <cstring>
 #include <string>
+#include <string_view>
 
 #include "definitions.hpp"
 
 namespace polylin {
 
-std::string trim(const std::string& str) {
+inline std::string trim(const std::string& str) {
   size_t start = str.find_first_not_of(' ');
   if (start == std::string::npos) return "";
   size_t end = str.find_last_not_of(' ');
@@ -13,4 +17,39 @@ std::string trim(const std::string& str) {
   return str.substr(start, end - start + 1);
 }
 
+// 64-bit hash of `data`, mixing four lanes of 8-byte words at a time so
+// that hashing runs at about memory bandwidth
+inline uint64_t contentHash(std::string_view data) {
+  constexpr uint64_t P1 = 0x9e3779b185ebca87, P2 = 0xc2b2ae3d27d4eb4f,
+                     P3 = 0x165667b19e3779f9, P4 = 0x85ebca77c2b2ae63;
+  auto load = [](const char* p) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return word;
+  };
+  auto round = [](uint64_t acc, uint64_t word) {
+    return std::rotl(acc + word * P2, 31) * P1;
+  };
+
+  const char* p = data.data();
+  size_t n = data.size();
+  uint64_t h = P3 + data.size();
+  if (n >= 32) {
+    uint64_t lanes[4] = {P1 + P2, P2, 0, -P1};
+    for (; n >= 32; p += 32, n -= 32)
+      for (size_t i = 0; i < 4; ++i)
+        lanes[i] = round(lanes[i], load(p + 8 * i));
+    h = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) +
+        std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18) + data.size();
+  }
+  for (; n >= 8; p += 8, n -= 8)
+    h = std::rotl(h ^ round(0, load(p)), 27) * P1 + P4;
+  for (; n; ++p, --n) h = std::rotl(h ^ (uint8_t(*p) * P3), 11) * P1;
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  return h ^ (h >> 32);
+}
+
 }  // namespace polylin
\ No newline at end of file
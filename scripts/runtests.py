@@ -70,6 +70,7 @@ def run_verilin(impl):
 def main():
   parser = argparse.ArgumentParser('runtest', './runtest.py <object>', 'script for running test suite')
   parser.add_argument('object', help='object to test')
+  parser.add_argument('--keep-empties', action='store_true', help='keep empty removes in histories')
   args = parser.parse_args()
   tests = []
   with open('test_config.csv', 'r') as test_file:
@@ -80,8 +81,11 @@ def main():
     for _ in range(repeats):
       num_oper = int(test[0])
       generate_history(num_oper, args.object)
-      remove_empties(scal_pre_filename, scal_filename)
-      subprocess.Popen(f'./scal-polylin.py {scal_filename} {polylin_filename} {args.object}', shell=True).wait()
+      scal_input = scal_pre_filename
+      if not args.keep_empties:
+        remove_empties(scal_pre_filename, scal_filename)
+        scal_input = scal_filename
+      subprocess.Popen(f'./scal-polylin.py {scal_input} {polylin_filename} {args.object}', shell=True).wait()
       subprocess.Popen(f'./polylin-violin.py {polylin_filename} {violin_filename}', shell=True).wait()
       subprocess.Popen(f'./polylin-verilin.py {polylin_filename} {verilin_filename}', shell=True).wait()
       polylin_mem, polylin_time = run_polylin()
@@ -0,0 +1,450 @@
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "ingest.hpp"
+#include "inject.hpp"
+#include "reader.hpp"
+#include "recorder.hpp"
+#include "synth.hpp"
+
+using namespace polylin;
+
+typedef DEFAULT_VALUE_TYPE value_type;
+typedef History<value_type> hist_t;
+typedef std::chrono::high_resolution_clock hr_clock;
+
+// Deque histories beyond this size are only benchmarked on request, as the
+// deque monitor is cubic
+#define DEQUE_DEFAULT_MAX 10000
+
+// File buffers in flight when benchmarking the file loaders
+#define INGEST_BUFFERS 8
+
+// Exposes the shared preprocessing of a monitor
+template <typename monitor_t>
+class phase_probe : public monitor_t {
+ public:
+  using monitor_t::preprocess;
+};
+
+// Best seconds of each phase over the repeats, phases not run being empty
+struct phase_times {
+  std::optional<double> parse, preprocess, distVal, incremental;
+};
+
+struct bench_result {
+  std::string name, type, source;
+  size_t numOper;
+  bool linearizable = false;
+  bool violationFound = false;
+  phase_times phases{};
+  long peakRssKb = 0;
+};
+
+// Returns freed heap memory first, so that earlier benchmarks do not count
+void reset_peak_rss() {
+  malloc_trim(0);
+  std::ofstream clearRefs("/proc/self/clear_refs");
+  clearRefs << "5";
+}
+
+// Peak resident set size since the last reset, in kB
+long peak_rss_kb() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line))
+    if (line.rfind("VmHWM:", 0) == 0) return std::stol(line.substr(6));
+  return -1;
+}
+
+template <typename fn_t>
+double time_secs(fn_t fn) {
+  hr_clock::time_point start = hr_clock::now();
+  fn();
+  return std::chrono::duration<double>(hr_clock::now() - start).count();
+}
+
+void keep_best(std::optional<double>& best, double secs) {
+  if (!best || secs < *best) best = secs;
+}
+
+// Times the phases of checking `hist` with `monitor_t`: parsing `text`, the
+// shared preprocessing, a full check and an incremental check of
+// `violating`, or of `hist` itself if none
+template <typename monitor_t>
+void time_phases(const std::string& type, const std::string& text,
+                 const hist_t& hist, const hist_t* violating, size_t repeats,
+                 bench_result& result) {
+  phase_times& phases = result.phases;
+  for (size_t i = 0; i < repeats; ++i) {
+    hist_t parsed;
+    parsed.reserve(hist.size());
+    keep_best(phases.parse, time_secs([&]() {
+                parseHistory(text, hasRetVal(type), parsed);
+              }));
+
+    if constexpr (!std::is_same_v<monitor_t, SetLin<value_type>>) {
+      phase_probe<monitor_t> probe;
+      hist_t copy = hist;
+      keep_best(phases.preprocess,
+                time_secs([&]() { probe.preprocess(copy); }));
+    }
+
+    monitor_t monitor;
+    hist_t copy = hist;
+    keep_best(phases.distVal, time_secs([&]() {
+                result.linearizable = monitor.distVal(std::move(copy));
+              }));
+
+    const hist_t& searched = violating ? *violating : hist;
+    keep_best(phases.incremental, time_secs([&]() {
+                result.violationFound =
+                    !checkHistory(monitor, searched, true).linearizable;
+              }));
+  }
+}
+
+void run_bench(const std::string& type, const std::string& text,
+               const hist_t& hist, const hist_t* violating, size_t repeats,
+               bench_result& result) {
+  if (type == "stack")
+    time_phases<StackLin<value_type>>(type, text, hist, violating, repeats,
+                                      result);
+  else if (type == "queue")
+    time_phases<QueueLin<value_type>>(type, text, hist, violating, repeats,
+                                      result);
+  else if (type == "pqueue")
+    time_phases<PriorityQueueLin<value_type>>(type, text, hist, violating,
+                                              repeats, result);
+  else if (type == "set")
+    time_phases<SetLin<value_type>>(type, text, hist, violating, repeats,
+                                    result);
+  else if (type == "deque")
+    time_phases<DequeLin<value_type>>(type, text, hist, violating, repeats,
+                                      result);
+  else
+    throw std::invalid_argument("Unknown data type");
+}
+
+// Benchmarks a synthesized history of `type`, searching a copy with a lost
+// value injected halfway for the incremental phase
+bench_result bench_synth(const std::string& type, const synth_params& params,
+                         size_t repeats) {
+  reset_peak_rss();
+  bench_result result{type + "/" + std::to_string(params.numOper), type,
+                      "synth", params.numOper};
+  hist_t hist = synthHistory<value_type>(type, params);
+  std::ostringstream text;
+  writeHistory(text, type, hist);
+  hist_t violating = hist;
+  bool injected =
+      injectViolation(violating, type, violation_kind::lost, 0.5).has_value();
+  run_bench(type, text.str(), hist, injected ? &violating : nullptr, repeats,
+            result);
+  result.peakRssKb = peak_rss_kb();
+  return result;
+}
+
+bench_result bench_file(const std::string& path, size_t repeats) {
+  reset_peak_rss();
+  std::string text = readFile(path);
+  std::string type = parseHistType(text);
+  hist_t hist;
+  parseHistory(text, hasRetVal(type), hist);
+  bench_result result{path, type, "file", hist.size()};
+  run_bench(type, text, hist, nullptr, repeats, result);
+  result.peakRssKb = peak_rss_kb();
+  return result;
+}
+
+// Best seconds of reading files with one method, and the lines counted in
+// them as a stand-in for parsing
+struct ingest_result {
+  std::string method;
+  size_t numFiles, bytes, lines = 0;
+  double seconds = 0;
+};
+
+// Drops the cached pages of `files`, so that every method reads from disk
+void evict_files(const std::vector<std::string>& files) {
+  for (const std::string& path : files) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) continue;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+size_t count_lines(const char* data, size_t size) {
+  return std::count(data, data + size, '\n');
+}
+
+// Reads `files` through `fileLoader` with `INGEST_BUFFERS` files in flight
+size_t load_files(FileLoader& fileLoader,
+                  const std::vector<std::string>& files) {
+  std::vector<std::string> buffers(INGEST_BUFFERS);
+  std::vector<size_t> free(INGEST_BUFFERS);
+  for (size_t i = 0; i < free.size(); ++i) free[i] = i;
+  std::vector<size_t> bufferOf(files.size());
+  size_t lines = 0;
+  for (size_t next = 0; next < files.size() || fileLoader.pending();) {
+    for (; next < files.size() && !free.empty(); ++next) {
+      bufferOf[next] = free.back();
+      free.pop_back();
+      fileLoader.submit(next, files[next], buffers[bufferOf[next]]);
+    }
+    loaded_file file = fileLoader.wait();
+    if (!file.error.empty()) throw std::runtime_error(file.error);
+    const std::string& text = buffers[bufferOf[file.tag]];
+    lines += count_lines(text.data(), text.size());
+    free.push_back(bufferOf[file.tag]);
+  }
+  return lines;
+}
+
+size_t map_files(const std::vector<std::string>& files) {
+  size_t lines = 0;
+  for (const std::string& path : files) {
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+      throw std::runtime_error("Cannot open file: " + path);
+    if (st.st_size) {
+      void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED)
+        throw std::runtime_error("Cannot map file: " + path);
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      lines += count_lines(static_cast<const char*>(data), st.st_size);
+      munmap(data, st.st_size);
+    }
+    close(fd);
+  }
+  return lines;
+}
+
+// Times reading `files` with `std::ifstream`, `mmap`, `pread` and io_uring
+// from a cold page cache
+std::vector<ingest_result> bench_ingest(const std::vector<std::string>& files,
+                                        size_t repeats) {
+  size_t bytes = 0;
+  for (const std::string& path : files)
+    bytes += std::filesystem::file_size(path);
+
+  std::vector<std::pair<std::string, std::function<size_t()>>> methods{
+      {"ifstream",
+       [&]() {
+         size_t lines = 0;
+         std::string text;
+         for (const std::string& path : files) {
+           readFile(path, text);
+           lines += count_lines(text.data(), text.size());
+         }
+         return lines;
+       }},
+      {"mmap", [&]() { return map_files(files); }},
+      {"pread",
+       [&]() {
+         PreadLoader fileLoader;
+         return load_files(fileLoader, files);
+       }},
+      {"uring", [&]() {
+         UringLoader fileLoader;
+         return load_files(fileLoader, files);
+       }}};
+
+  std::vector<ingest_result> results;
+  for (const auto& [method, read] : methods) {
+    ingest_result result{method, files.size(), bytes};
+    std::optional<double> best;
+    for (size_t i = 0; i < repeats; ++i) {
+      evict_files(files);
+      keep_best(best, time_secs([&]() { result.lines = read(); }));
+    }
+    result.seconds = *best;
+    results.push_back(result);
+  }
+  return results;
+}
+
+std::string json_string(const std::string& str) {
+  std::string quoted = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') quoted += '\\';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+std::string json_number(const std::optional<double>& value) {
+  if (!value) return "null";
+  std::ostringstream out;
+  out << *value;
+  return out.str();
+}
+
+void write_json_header(std::ostream& out, const synth_params& params,
+                       size_t repeats) {
+  out << "{\n  \"context\": {\n"
+      << "    \"cpus\": " << std::thread::hardware_concurrency() << ",\n"
+      << "    \"compiler\": " << json_string(__VERSION__) << ",\n"
+      << "    \"num_proc\": " << params.numProc << ",\n"
+      << "    \"empty_ratio\": " << params.emptyRatio << ",\n"
+      << "    \"seed\": " << params.seed << ",\n"
+      << "    \"repeats\": " << repeats << "\n  },\n"
+      << "  \"benchmarks\": [";
+}
+
+// Writes the result of a benchmark as soon as it is done, so that results
+// survive later benchmarks running out of memory
+void write_json_result(std::ostream& out, const bench_result& r, bool first) {
+  std::optional<double> nsPerOp;
+  if (r.phases.distVal && r.numOper)
+    nsPerOp = *r.phases.distVal * 1e9 / r.numOper;
+  out << (first ? "\n" : ",\n") << "    {\n"
+      << "      \"name\": " << json_string(r.name) << ",\n"
+      << "      \"type\": " << json_string(r.type) << ",\n"
+      << "      \"source\": " << json_string(r.source) << ",\n"
+      << "      \"num_oper\": " << r.numOper << ",\n"
+      << "      \"linearizable\": " << std::boolalpha << r.linearizable
+      << ",\n"
+      << "      \"violation_found\": " << r.violationFound << ",\n"
+      << "      \"ns_per_op\": " << json_number(nsPerOp) << ",\n"
+      << "      \"peak_rss_kb\": " << r.peakRssKb << ",\n"
+      << "      \"phases\": {\n"
+      << "        \"parse\": " << json_number(r.phases.parse) << ",\n"
+      << "        \"preprocess\": " << json_number(r.phases.preprocess)
+      << ",\n"
+      << "        \"dist_val\": " << json_number(r.phases.distVal) << ",\n"
+      << "        \"incremental\": " << json_number(r.phases.incremental)
+      << "\n      }\n    }" << std::flush;
+}
+
+void write_json_ingest(std::ostream& out, const ingest_result& r,
+                       bool first) {
+  out << (first ? "\n" : ",\n") << "    {\n"
+      << "      \"name\": " << json_string("ingest/" + r.method) << ",\n"
+      << "      \"method\": " << json_string(r.method) << ",\n"
+      << "      \"num_files\": " << r.numFiles << ",\n"
+      << "      \"bytes\": " << r.bytes << ",\n"
+      << "      \"lines\": " << r.lines << ",\n"
+      << "      \"seconds\": " << r.seconds << ",\n"
+      << "      \"mb_per_s\": " << r.bytes / 1e6 / r.seconds << "\n    }"
+      << std::flush;
+}
+
+void write_json_footer(std::ostream& out) { out << "\n  ]\n}" << std::endl; }
+
+std::vector<std::string> split_list(const std::string& list) {
+  std::vector<std::string> items;
+  std::istringstream in{list};
+  std::string item;
+  while (std::getline(in, item, ','))
+    if (!item.empty()) items.push_back(item);
+  return items;
+}
+
+int main(int argc, char* argv[]) {
+  synth_params params{0, 20, 1};
+  size_t repeats = 3;
+  std::vector<std::string> types{"stack", "queue", "pqueue", "set", "deque"};
+  std::vector<size_t> sizes{1000, 10000, 100000, 1000000};
+  bool sizesGiven = false;
+  bool ingest = false;
+  std::string output;
+
+  int flag;
+  while ((flag = getopt(argc, argv, "e:In:o:p:r:s:t:")) != -1) switch (flag) {
+      case 'e':
+        params.emptyRatio = std::stod(optarg);
+        break;
+      case 'I':
+        ingest = true;
+        break;
+      case 'n':
+        sizes.clear();
+        for (const std::string& size : split_list(optarg))
+          sizes.push_back(std::stod(size));
+        sizesGiven = true;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'p':
+        params.numProc = std::stoull(optarg);
+        break;
+      case 'r':
+        repeats = std::max<size_t>(std::stoull(optarg), 1);
+        break;
+      case 's':
+        params.seed = std::stoul(optarg);
+        break;
+      case 't':
+        types = split_list(optarg);
+        break;
+      default:
+        std::cerr << "usage: ./polylin_bench [-e empty_ratio] [-I] [-n sizes] "
+                     "[-o output] [-p num_proc] [-r repeats] [-s seed] "
+                     "[-t types] [history...]"
+                  << std::endl;
+        return 1;
+    }
+
+  std::ofstream file;
+  if (!output.empty()) {
+    file.open(output);
+    if (!file) {
+      std::cerr << "Cannot open file: " << output << std::endl;
+      return 1;
+    }
+  }
+  std::ostream& out = output.empty() ? std::cout : file;
+
+  write_json_header(out, params, repeats);
+  bool first = true;
+  auto report = [&](const bench_result& result) {
+    write_json_result(out, result, std::exchange(first, false));
+  };
+  try {
+    if (ingest) {
+      for (const ingest_result& result :
+           bench_ingest({argv + optind, argv + argc}, repeats))
+        write_json_ingest(out, result, std::exchange(first, false));
+      write_json_footer(out);
+      return 0;
+    }
+    if (optind == argc) {
+      for (const std::string& type : types)
+        for (size_t size : sizes) {
+          if (type == "deque" && !sizesGiven && size > DEQUE_DEFAULT_MAX)
+            continue;
+          params.numOper = size;
+          report(bench_synth(type, params, repeats));
+        }
+    }
+    for (int i = optind; i < argc; ++i) report(bench_file(argv[i], repeats));
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  write_json_footer(out);
+  return 0;
+}
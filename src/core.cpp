@@ -0,0 +1,109 @@
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <thread>
+#include <utility>
+
+#include "check.hpp"
+#include "polylin.hpp"
+
+namespace polylin {
+
+namespace {
+
+// Log of a single thread, appended to by that thread only
+struct thread_log {
+  std::thread::id owner;
+  // Process of the operations of the thread, its registration index
+  proc_type proc;
+  History<log_value_type> ops;
+  thread_log* next;
+};
+
+// Logs are told apart by id, as their addresses may be reused
+std::atomic<uint64_t> nextLogId{0};
+
+// Thread log last appended to by the calling thread
+struct log_cache {
+  uint64_t logId = std::numeric_limits<uint64_t>::max();
+  thread_log* log = nullptr;
+};
+thread_local log_cache lastLog;
+
+}  // namespace
+
+struct HistoryLog::impl {
+  std::unique_ptr<Monitor<log_value_type>> monitor;
+  const uint64_t id = nextLogId.fetch_add(1, std::memory_order_relaxed);
+  // Thread logs, prepended on registration and freed with the history log
+  std::atomic<thread_log*> logs{nullptr};
+
+  ~impl() {
+    for (thread_log* log = logs.load(); log;)
+      delete std::exchange(log, log->next);
+  }
+
+  thread_log& threadLog() {
+    if (lastLog.logId == id) return *lastLog.log;
+
+    // A thread switching between history logs finds its own log again
+    const std::thread::id self = std::this_thread::get_id();
+    thread_log* log = logs.load(std::memory_order_acquire);
+    while (log && log->owner != self) log = log->next;
+    if (!log) {
+      // Threads past the last process id record operations without one
+      log = new thread_log{self, 0, {}, logs.load(std::memory_order_acquire)};
+      do {
+        const thread_log* prev = log->next;
+        log->proc = !prev                  ? 0
+                    : prev->proc == NO_PROC ? NO_PROC
+                                            : prev->proc + 1;
+      } while (!logs.compare_exchange_weak(log->next, log,
+                                           std::memory_order_acq_rel,
+                                           std::memory_order_acquire));
+    }
+    lastLog = {id, log};
+    return *log;
+  }
+};
+
+HistoryLog::HistoryLog(const std::string& type) : pimpl(new impl) {
+  pimpl->monitor = getMonitor<log_value_type>(type);
+}
+
+HistoryLog::~HistoryLog() = default;
+
+time_type HistoryLog::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void HistoryLog::append(Method method, log_value_type value,
+                        time_type startTime, time_type endTime, bool retVal) {
+  thread_log& log = pimpl->threadLog();
+  log.ops.emplace_back(method, value, startTime, endTime, retVal, log.proc);
+}
+
+History<log_value_type> HistoryLog::history() const {
+  size_t size = 0;
+  for (thread_log* log = pimpl->logs.load(); log; log = log->next)
+    size += log->ops.size();
+
+  History<log_value_type> hist;
+  hist.reserve(size);
+  for (thread_log* log = pimpl->logs.load(); log; log = log->next)
+    hist.insert(hist.end(), log->ops.begin(), log->ops.end());
+  return hist;
+}
+
+check_result HistoryLog::check(bool incremental) const {
+  return checkHistory(*pimpl->monitor, history(), incremental);
+}
+
+void HistoryLog::clear() {
+  for (thread_log* log = pimpl->logs.load(); log; log = log->next)
+    log->ops.clear();
+}
+
+}  // namespace polylin
@@ -0,0 +1,259 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "commons/concurrent.hpp"
+#include "recorder.hpp"
+
+using namespace polylin;
+
+typedef DEFAULT_VALUE_TYPE value_type;
+typedef Recorder<value_type> recorder_t;
+typedef std::chrono::high_resolution_clock hr_clock;
+
+struct gen_params {
+  size_t numOper;
+  size_t numThreads;
+  // Keys of set histories, fewer keys meaning more contention per key
+  size_t numKeys;
+  // Iterations of local work between operations, less meaning more contention
+  size_t think;
+  unsigned seed;
+};
+
+// Per-thread state of a generator run
+struct worker {
+  size_t tid;
+  recorder_t::ThreadLog& log;
+  std::mt19937_64 rng;
+  value_type nextVal;
+  size_t stride;
+
+  // Fresh value, unique across threads
+  value_type fresh() { return std::exchange(nextVal, nextVal + stride); }
+
+  // Uniform integer in `[0, n)`
+  size_t roll(size_t n) { return rng() % n; }
+};
+
+void think(size_t iterations) {
+  for (size_t i = 0; i < iterations; ++i) asm volatile("" ::: "memory");
+}
+
+// Runs `step` `numOper` times in total over the threads of `params`,
+// recording into `recorder`, and returns the seconds taken
+template <typename step_fn>
+double run_workers(const gen_params& params, recorder_t& recorder,
+                   step_fn step) {
+  std::atomic<size_t> ready{0};
+  std::vector<std::thread> threads;
+  hr_clock::time_point start;
+  for (size_t tid = 0; tid < params.numThreads; ++tid)
+    threads.emplace_back([&, tid]() {
+      size_t numOper = params.numOper / params.numThreads +
+                       (tid < params.numOper % params.numThreads);
+      worker w{tid, recorder.thread(tid), std::mt19937_64(params.seed + tid),
+               value_type(tid), params.numThreads};
+      // start together so that all threads overlap from the first operation
+      if (ready.fetch_add(1) + 1 == params.numThreads) start = hr_clock::now();
+      while (ready.load() < params.numThreads) cpuRelax();
+      for (size_t i = 0; i < numOper; ++i) {
+        step(w);
+        think(params.think);
+      }
+    });
+  for (std::thread& thread : threads) thread.join();
+  return std::chrono::duration<double>(hr_clock::now() - start).count();
+}
+
+// Maximum number of operations run by one thread, bounding its pushes
+size_t per_thread(const gen_params& params) {
+  return params.numOper / params.numThreads + 1;
+}
+
+double gen_stack(const gen_params& params, recorder_t& recorder) {
+  treiber_stack<value_type> stack(params.numThreads, per_thread(params));
+  return run_workers(params, recorder, [&](worker& w) {
+    size_t dice = w.roll(10);
+    time_type start = recorder_t::now();
+    if (dice < 5) {
+      value_type value = w.fresh();
+      stack.push(w.tid, value);
+      w.log.complete(PUSH, value, start);
+    } else {
+      value_type value = EMPTY_VALUE;
+      if (dice < 9)
+        stack.pop(value);
+      else
+        stack.peek(value);
+      w.log.complete(dice < 9 ? POP : PEEK, value, start);
+    }
+  });
+}
+
+double gen_queue(const gen_params& params, recorder_t& recorder) {
+  ms_queue<value_type> queue(params.numThreads, per_thread(params));
+  return run_workers(params, recorder, [&](worker& w) {
+    time_type start = recorder_t::now();
+    if (w.roll(2)) {
+      value_type value = w.fresh();
+      queue.enqueue(w.tid, value);
+      w.log.complete(ENQ, value, start);
+    } else {
+      value_type value = EMPTY_VALUE;
+      queue.dequeue(value);
+      w.log.complete(DEQ, value, start);
+    }
+  });
+}
+
+double gen_pqueue(const gen_params& params, recorder_t& recorder) {
+  locked_pqueue<value_type> pqueue;
+  return run_workers(params, recorder, [&](worker& w) {
+    size_t dice = w.roll(10);
+    time_type start = recorder_t::now();
+    if (dice < 5) {
+      // shuffle priorities within blocks of 256 values of each thread
+      size_t k = w.fresh() / w.stride;
+      value_type value = ((k & ~size_t(255)) | ((k * 167) & 255)) * w.stride +
+                         w.tid;
+      pqueue.insert(value);
+      w.log.complete(INSERT, value, start);
+    } else {
+      value_type value = EMPTY_VALUE;
+      if (dice < 9)
+        pqueue.poll(value);
+      else
+        pqueue.peek(value);
+      w.log.complete(dice < 9 ? POLL : PEEK, value, start);
+    }
+  });
+}
+
+double gen_deque(const gen_params& params, recorder_t& recorder) {
+  locked_deque<value_type> deque;
+  return run_workers(params, recorder, [&](worker& w) {
+    size_t dice = w.roll(10);
+    bool front = w.roll(2);
+    time_type start = recorder_t::now();
+    if (dice < 5) {
+      value_type value = w.fresh();
+      deque.push(front, value);
+      w.log.complete(front ? PUSH_FRONT : PUSH_BACK, value, start);
+    } else if (dice < 9) {
+      value_type value = EMPTY_VALUE;
+      deque.pop(front, value);
+      w.log.complete(front ? POP_FRONT : POP_BACK, value, start);
+    } else {
+      value_type value = EMPTY_VALUE;
+      deque.peek(front, value);
+      w.log.complete(front ? PEEK_FRONT : PEEK_BACK, value, start);
+    }
+  });
+}
+
+double gen_set(const gen_params& params, recorder_t& recorder) {
+  flag_set set(params.numKeys);
+  return run_workers(params, recorder, [&](worker& w) {
+    size_t dice = w.roll(3);
+    value_type key = w.roll(params.numKeys);
+    time_type start = recorder_t::now();
+    if (dice == 0)
+      w.log.complete(INSERT, key, start, set.insert(key));
+    else if (dice == 1)
+      w.log.complete(REMOVE, key, start, set.remove(key));
+    else
+      w.log.complete(CONTAINS, key, start, set.contains(key));
+  });
+}
+
+int main(int argc, char* argv[]) {
+  gen_params params{1000000, std::max(1u, std::thread::hardware_concurrency()),
+                    0, 0, 1};
+  bool binary = false;
+  std::string output;
+
+  int flag;
+  while ((flag = getopt(argc, argv, "bk:n:o:p:s:w:")) != -1) switch (flag) {
+      case 'b':
+        binary = true;
+        break;
+      case 'k':
+        params.numKeys = std::stoull(optarg);
+        break;
+      case 'n':
+        params.numOper = std::stoull(optarg);
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'p':
+        params.numThreads = std::max<size_t>(std::stoull(optarg), 1);
+        break;
+      case 's':
+        params.seed = std::stoul(optarg);
+        break;
+      case 'w':
+        params.think = std::stoull(optarg);
+        break;
+      default:
+        optind = argc;
+    }
+  if (optind + 1 != argc) {
+    std::cerr << "usage: ./histgen [-b] [-k num_keys] [-n num_oper] "
+                 "[-o output] [-p num_threads] [-s seed] [-w think] <type>"
+              << std::endl;
+    return 1;
+  }
+  std::string type = argv[optind];
+  if (!params.numKeys) params.numKeys = std::max<size_t>(params.numOper / 8, 1);
+
+  recorder_t recorder(type, params.numThreads, per_thread(params));
+  double secs;
+  if (type == "stack")
+    secs = gen_stack(params, recorder);
+  else if (type == "queue")
+    secs = gen_queue(params, recorder);
+  else if (type == "pqueue")
+    secs = gen_pqueue(params, recorder);
+  else if (type == "deque")
+    secs = gen_deque(params, recorder);
+  else if (type == "set")
+    secs = gen_set(params, recorder);
+  else {
+    std::cerr << "Unknown data type: " << type << std::endl;
+    return 1;
+  }
+
+  hr_clock::time_point start = hr_clock::now();
+  std::ofstream file;
+  std::vector<char> buffer(1 << 20);
+  if (!output.empty()) {
+    file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+    file.open(output, std::ios::binary);
+    if (!file) {
+      std::cerr << "Cannot open file: " << output << std::endl;
+      return 1;
+    }
+  }
+  std::ostream& out = output.empty() ? std::cout : file;
+  if (binary)
+    recorder.writeBinary(out);
+  else
+    recorder.writeText(out);
+  out.flush();
+  double writeSecs =
+      std::chrono::duration<double>(hr_clock::now() - start).count();
+
+  std::cerr << "type num_oper threads seconds mops write_seconds\n"
+            << type << " " << params.numOper << " " << params.numThreads << " "
+            << secs << " " << (params.numOper / secs / 1e6) << " " << writeSecs
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,84 @@
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "inject.hpp"
+#include "reader.hpp"
+#include "recorder.hpp"
+
+using namespace polylin;
+
+typedef History<DEFAULT_VALUE_TYPE> hist_t;
+
+int main(int argc, char* argv[]) {
+  violation_kind kind = violation_kind::swap;
+  double depth = 0.5;
+  bool binary = false;
+  std::string output;
+
+  int flag;
+  while ((flag = getopt(argc, argv, "bd:k:o:")) != -1) switch (flag) {
+      case 'b':
+        binary = true;
+        break;
+      case 'd':
+        depth = std::stod(optarg);
+        break;
+      case 'k':
+        try {
+          kind = parseViolationKind(optarg);
+        } catch (const std::exception& e) {
+          std::cerr << e.what() << std::endl;
+          return 1;
+        }
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        optind = argc;
+    }
+  if (optind + 1 != argc) {
+    std::cerr << "usage: ./polylin_inject [-b] [-d depth] "
+                 "[-k swap|phantom|lost] [-o output] <history>"
+              << std::endl;
+    return 1;
+  }
+
+  std::string type;
+  hist_t hist;
+  std::optional<time_type> time;
+  try {
+    std::string text = readFile(argv[optind]);
+    type = parseHistType(text);
+    parseHistory(text, hasRetVal(type), hist);
+    time = injectViolation(hist, type, kind, depth);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  if (!time) {
+    std::cerr << "No operation to inject into" << std::endl;
+    return 1;
+  }
+
+  std::ofstream file;
+  if (!output.empty()) {
+    file.open(output, std::ios::binary);
+    if (!file) {
+      std::cerr << "Cannot open file: " << output << std::endl;
+      return 1;
+    }
+  }
+  std::ostream& out = output.empty() ? std::cout : file;
+  if (binary)
+    writeBinaryHistory(out, type, hist);
+  else
+    writeHistory(out, type, hist);
+
+  // upper bound of the violation time reported by `polylin -i`
+  std::cerr << *time << std::endl;
+  return 0;
+}
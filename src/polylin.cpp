@@ -1,56 +1,139 @@
+#include <getopt.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
 #include <memory>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <thread>
 
-#include "deque.hpp"
-#include "priorityqueue.hpp"
-#include "queue.hpp"
+#include "batch.hpp"
+#include "cache.hpp"
+#include "check.hpp"
+#include "external.hpp"
 #include "reader.hpp"
-#include "set.hpp"
-#include "stack.hpp"
+#include "server.hpp"
+#include "stats.hpp"
 
 using namespace polylin;
 
-template <typename value_type>
-std::unique_ptr<LinBase<value_type>> get_monitor(const std::string& type) {
-  if (type == "stack") return std::make_unique<StackLin<value_type>>();
-  if (type == "queue") return std::make_unique<QueueLin<value_type>>();
-  if (type == "pqueue") return std::make_unique<PriorityQueueLin<value_type>>();
-  if (type == "set") return std::make_unique<SetLin<value_type>>();
-  if (type == "deque") return std::make_unique<DequeLin<value_type>>();
-  throw std::invalid_argument("Unknown data type");
+typedef std::unique_ptr<Monitor<DEFAULT_VALUE_TYPE>> monitor_ptr_t;
+typedef History<DEFAULT_VALUE_TYPE> hist_t;
+typedef HistoryReader<DEFAULT_VALUE_TYPE> hist_reader_t;
+typedef std::chrono::high_resolution_clock hr_clock;
+
+#ifdef POLYLIN_STATS
+// Counts allocations for `--stats`
+void* operator new(size_t size) {
+  stats::countAllocation(size);
+  if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+  throw std::bad_alloc();
 }
 
-template <typename value_type>
-std::vector<time_type> get_times(const History<value_type>& hist) {
-  std::set<time_type> times;
-  for (const auto& o : hist) {
-    times.insert(o.startTime);
-    times.insert(o.endTime);
-  }
-  return {times.begin(), times.end()};
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+#endif
+
+// Parses a byte count with an optional K, M or G binary suffix
+size_t parse_size(const std::string& str) {
+  size_t end;
+  size_t size = std::stoull(str, &end);
+  if (end + 1 < str.size()) throw std::invalid_argument("Bad size: " + str);
+  if (end < str.size()) switch (str[end]) {
+      case 'G':
+        size <<= 10;
+        [[fallthrough]];
+      case 'M':
+        size <<= 10;
+        [[fallthrough]];
+      case 'K':
+        size <<= 10;
+        break;
+      default:
+        throw std::invalid_argument("Bad size: " + str);
+    }
+  return size;
 }
 
-typedef std::unique_ptr<LinBase<DEFAULT_VALUE_TYPE>> monitor_ptr_t;
-typedef History<DEFAULT_VALUE_TYPE> hist_t;
-typedef HistoryReader<DEFAULT_VALUE_TYPE> hist_reader_t;
-typedef std::chrono::high_resolution_clock hr_clock;
+// Parses the output of a timed check, as answered by a server
+std::optional<cached_result> parse_timed_result(const std::string& output,
+                                                bool incremental) {
+  std::istringstream fields(output);
+  cached_result entry{{false, 0}, 0};
+  std::string violation = "-1";
+  fields >> entry.result.linearizable;
+  if (incremental) fields >> violation;
+  fields >> entry.seconds;
+  if (!fields) return std::nullopt;
+  if (!entry.result.linearizable)
+    entry.result.violationTime = std::stoull(violation);
+  return entry;
+}
 
 int main(int argc, char* argv[]) {
   bool incremental = false;
   bool print_time = false;
-  std::string input_file;
+  bool print_stats = false;
+  bool print_server_stats = false;
+  std::string input_file, batch_list, serve_socket;
+  // Directory of the result cache, none if empty
+  const char* cache_env = std::getenv("POLYLIN_CACHE");
+  std::string cache_dir = cache_env ? cache_env : "";
+  size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  // Bytes of memory to check within, unbounded if 0
+  size_t mem_limit = 0;
+  io_method io = io_method::automatic;
 
+  const option long_options[] = {{"batch", required_argument, nullptr, 'b'},
+                                 {"cache", required_argument, nullptr, 'c'},
+                                 {"io", required_argument, nullptr, 'o'},
+                                 {"jobs", required_argument, nullptr, 'j'},
+                                 {"mem-limit", required_argument, nullptr,
+                                  'm'},
+                                 {"serve", required_argument, nullptr, 's'},
+                                 {"server-stats", no_argument, nullptr, 'L'},
+                                 {"stats", no_argument, nullptr, 'S'},
+                                 {nullptr, 0, nullptr, 0}};
   int flag;
-  while ((flag = getopt(argc, argv, "it")) != -1) switch (flag) {
+  while ((flag = getopt_long(argc, argv, "b:ij:t", long_options, nullptr)) !=
+         -1)
+    switch (flag) {
+      case 'b':
+        batch_list = optarg;
+        break;
+      case 'j':
+        num_threads = std::stoull(optarg);
+        break;
       case 'i':
         incremental = true;
         break;
       case 't':
         print_time = true;
         break;
+      case 'c':
+        cache_dir = optarg;
+        break;
+      case 'o':
+        io = parseIoMethod(optarg);
+        break;
+      case 'm':
+        mem_limit = parse_size(optarg);
+        break;
+      case 's':
+        serve_socket = optarg;
+        break;
+      case 'L':
+        print_server_stats = true;
+        break;
+      case 'S':
+        print_stats = true;
+        break;
       case '?':
         std::cerr << "Unknown option `" << optopt << "'.\n";
         return 1;
@@ -59,46 +142,178 @@ int main(int argc, char* argv[]) {
     }
   if (optind < argc) input_file = argv[optind];
 
-  hist_reader_t reader(input_file);
-  std::string histType = reader.getHistTypeStr();
-  monitor_ptr_t monitor = get_monitor<DEFAULT_VALUE_TYPE>(histType);
-  auto hist = (histType == "set") ? reader.getExtHist() : reader.getHist();
-
-  hist_t hist_copy;
-  if (incremental) hist_copy = hist;  // copy for incremental use
-
-  hr_clock::time_point start = hr_clock::now();
-  bool result = monitor->distVal(hist);
-  hr_clock::time_point end = hr_clock::now();
-  long long time_micros =
-      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
-          .count();
-
-  std::cout << result;
-
-  if (incremental) {
-    if (result) {
-      std::cout << " -1";
-    } else {
-      auto times = get_times(hist_copy);
-      time_type low = 0, high = times.size() - 1;
-      while (low < high) {
-        time_type mid = low + (high - low) / 2;
-        hist_t subhist = monitor->getSubHist(hist_copy, times[mid]);
-        result = monitor->distVal(subhist);
-        if (result)
-          low = mid + 1;
-        else
-          high = mid;
+#ifdef POLYLIN_STATS
+  stats::enabled = print_stats;
+#else
+  if (print_stats) {
+    std::cerr << "--stats requires building with -DPOLYLIN_STATS=ON"
+              << std::endl;
+    return 1;
+  }
+#endif
+
+  if (batch_list.empty() && io != io_method::automatic) {
+    std::cerr << "--io only applies to --batch" << std::endl;
+    return 1;
+  }
+  if (!batch_list.empty()) {
+    if (mem_limit) {
+      std::cerr << "--mem-limit does not apply to --batch" << std::endl;
+      return 1;
+    }
+    try {
+      std::optional<ResultCache> cache;
+      if (!cache_dir.empty()) cache.emplace(cache_dir);
+      batch_params params{num_threads, 2 * num_threads, incremental,
+                          print_time, io, cache ? &*cache : nullptr};
+      runBatch<DEFAULT_VALUE_TYPE>(listHistories(batch_list), params,
+                                   std::cout, std::cerr);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+#ifdef POLYLIN_STATS
+    if (print_stats) stats::writeJson(std::cerr);
+#endif
+    return 0;
+  }
+
+  if (!serve_socket.empty()) {
+    try {
+      runServer<DEFAULT_VALUE_TYPE>(serve_socket, num_threads, std::cerr);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+#ifdef POLYLIN_STATS
+    if (print_stats) stats::writeJson(std::cerr);
+#endif
+    return 0;
+  }
+
+  // Checks go to the server at `POLYLIN_SERVER` if it is running, falling
+  // back to checking in process
+  const char* server = std::getenv("POLYLIN_SERVER");
+  if (server && *server && !mem_limit && !print_stats &&
+      (print_server_stats || !input_file.empty())) {
+    std::string request = "STATS";
+    // Cached results are answered here. The server is asked to time its
+    // check, so that its result can be cached.
+    std::optional<ResultCache> cache;
+    content_key key{};
+    std::optional<std::string> response;
+    try {
+      if (!print_server_stats) {
+        if (!cache_dir.empty()) {
+          cache.emplace(cache_dir);
+          key = hist_reader_t(input_file).getContentKey();
+          if (std::optional<cached_result> hit =
+                  cache->find(key, incremental)) {
+            std::cout << formatResult(hit->result, incremental, print_time,
+                                      hit->seconds)
+                      << std::endl;
+            return 0;
+          }
+        }
+        std::string flags = incremental ? "i" : "";
+        if (print_time || cache) flags += 't';
+        request = "CHECK " + (flags.empty() ? "-" : flags) + " PATH " +
+                  std::filesystem::absolute(input_file).string();
       }
+      response = requestServer(server, request);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    if (response) {
+      if (print_server_stats) {
+        std::cout << *response << std::endl;
+        return 0;
+      }
+      if (response->rfind("OK ", 0) == 0) {
+        std::string output = response->substr(3);
+        if (cache)
+          if (std::optional<cached_result> checked =
+                  parse_timed_result(output, incremental)) {
+            cache->store(key, incremental, *checked);
+            output = formatResult(checked->result, incremental, print_time,
+                                  checked->seconds);
+          }
+        std::cout << output << std::endl;
+        return 0;
+      }
+      std::cerr << response->substr(response->find(' ') + 1) << std::endl;
+      return 1;
+    }
+  }
+  if (print_server_stats) {
+    std::cerr << "--server-stats requires a server running at POLYLIN_SERVER"
+              << std::endl;
+    return 1;
+  }
 
-      std::cout << " " << times[low];
+  if (mem_limit) {
+    // timed as a whole, as checking interleaves with reading
+    hr_clock::time_point start = hr_clock::now();
+    check_result result;
+    try {
+      result =
+          checkExternal<DEFAULT_VALUE_TYPE>(input_file, mem_limit, incremental);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
     }
+    long long time_micros =
+        std::chrono::duration_cast<std::chrono::microseconds>(hr_clock::now() -
+                                                              start)
+            .count();
+    std::cout << result.linearizable;
+    if (incremental)
+      std::cout << " "
+                << (result.linearizable ? "-1"
+                                        : std::to_string(result.violationTime));
+    if (print_time) std::cout << " " << (time_micros / 1e6);
+    std::cout << std::endl;
+#ifdef POLYLIN_STATS
+    if (print_stats) stats::writeJson(std::cerr);
+#endif
+    return 0;
   }
 
-  if (print_time) std::cout << " " << (time_micros / 1e6);
+  try {
+    hist_reader_t reader(input_file);
+    std::optional<ResultCache> cache;
+    content_key key{};
+    if (!cache_dir.empty()) {
+      cache.emplace(cache_dir);
+      key = reader.getContentKey();
+      if (std::optional<cached_result> hit = cache->find(key, incremental)) {
+        std::cout << formatResult(hit->result, incremental, print_time,
+                                  hit->seconds)
+                  << std::endl;
+#ifdef POLYLIN_STATS
+        if (print_stats) stats::writeJson(std::cerr);
+#endif
+        return 0;
+      }
+    }
+    std::string histType = reader.getHistTypeStr();
+    monitor_ptr_t monitor = getMonitor<DEFAULT_VALUE_TYPE>(histType);
+    auto hist = hasRetVal(histType) ? reader.getExtHist() : reader.getHist();
 
-  std::cout << std::endl;
+    double secs;
+    check_result result =
+        checkHistory(*monitor, std::move(hist), incremental, secs);
+    std::cout << formatResult(result, incremental, print_time, secs)
+              << std::endl;
+    if (cache) cache->store(key, incremental, {result, secs});
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
 
+#ifdef POLYLIN_STATS
+  if (print_stats) stats::writeJson(std::cerr);
+#endif
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,88 @@
+// Records concurrent histories through `HistoryLog` and checks them
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "polylin.hpp"
+
+using namespace polylin;
+
+namespace {
+
+constexpr int NUM_THREADS = 4;
+constexpr int OPS_PER_THREAD = 1000;
+
+int failures = 0;
+
+void expect(bool ok, const char* what) {
+  if (ok) return;
+  std::cerr << "FAILED: " << what << std::endl;
+  ++failures;
+}
+
+// Threads enqueue and dequeue on a locked queue, a linearizable history
+// with an operation of each thread in flight at once
+void recordQueue() {
+  HistoryLog log("queue");
+  std::mutex mutex;
+  std::queue<log_value_type> queue;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < NUM_THREADS; ++t)
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < OPS_PER_THREAD / 2; ++i) {
+        const log_value_type value = t * OPS_PER_THREAD + i;
+        time_type start = HistoryLog::now();
+        {
+          std::scoped_lock lock{mutex};
+          queue.push(value);
+        }
+        log.append(ENQ, value, start, HistoryLog::now());
+
+        start = HistoryLog::now();
+        log_value_type removed;
+        {
+          std::scoped_lock lock{mutex};
+          removed = queue.front();
+          queue.pop();
+        }
+        log.append(DEQ, removed, start, HistoryLog::now());
+      }
+    });
+  for (std::thread& thread : threads) thread.join();
+
+  const History<log_value_type> hist = log.history();
+  expect(hist.size() == NUM_THREADS * OPS_PER_THREAD, "all operations kept");
+  std::vector<int> opsOf(NUM_THREADS, 0);
+  for (const auto& o : hist) {
+    expect(o.proc < NUM_THREADS, "operations carry their thread");
+    if (o.proc < NUM_THREADS) ++opsOf[o.proc];
+  }
+  for (int ops : opsOf)
+    expect(ops == OPS_PER_THREAD, "threads get processes of their own");
+  expect(log.check().linearizable, "locked queue is linearizable");
+  expect(log.check(true).linearizable, "locked queue is linearizable");
+}
+
+// A thread dequeuing out of order
+void recordViolation() {
+  HistoryLog log("queue");
+  log.append(ENQ, 1, 1, 2);
+  log.append(ENQ, 2, 3, 4);
+  log.append(DEQ, 2, 5, 6);
+  log.append(DEQ, 1, 7, 8);
+  expect(!log.check().linearizable, "out of order dequeue is a violation");
+  const check_result result = log.check(true);
+  expect(!result.linearizable && result.violationTime == 6,
+         "violation observed once the dequeue responds");
+}
+
+}  // namespace
+
+int main() {
+  recordQueue();
+  recordViolation();
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,203 @@
+#!/usr/bin/python3
+# Checks the fixtures of this directory, named <type>_<name>.<expected>.log
+# with expected 1 (linearizable), 0 (not) or error, through every way polylin
+# reads and checks histories: text, binary and gzip files, -i, --batch,
+# --cache, --serve and --mem-limit. Histories recorded by histgen and the
+# simulators must be linearizable, and those broken by polylin_inject not.
+
+import argparse
+import glob
+import gzip
+import os
+import signal
+import struct
+import subprocess
+import tempfile
+import time
+
+# Method names indexed as `Method` in include/definitions.hpp
+METHODS = ['push', 'pop', 'peek', 'enq', 'deq', 'push_front', 'pop_front',
+           'peek_front', 'push_back', 'pop_back', 'peek_back', 'insert',
+           'poll', 'contains', 'remove']
+NO_PROC = 65535
+# Linearizable histories the deque monitor rejects
+KNOWN_REJECTS = {'deque_intermediate.1.log'}
+
+tests_dir = os.path.dirname(os.path.abspath(__file__))
+failures = 0
+
+def expect(ok: bool, what: str):
+  global failures
+  if not ok:
+    failures += 1
+    print('FAILED:', what)
+
+def run(args: list, env=None):
+  return subprocess.run(args, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                        text=True, env=env)
+
+def get_fixtures():
+  fixtures = []
+  for path in sorted(glob.glob(os.path.join(tests_dir, '*.log'))):
+    name = os.path.basename(path)
+    expected = name.split('.')[-2]
+    if name in KNOWN_REJECTS:
+      expected = '0'
+    fixtures.append((path, name.split('_')[0], expected))
+  return fixtures
+
+# Binary history of the text history at `path`, records carrying processes
+def to_binary(path: str, hist_type: str):
+  records = []
+  with open(path, 'r') as hist_file:
+    for line in hist_file:
+      fields = line.split()
+      if not fields or fields[0].startswith('#'):
+        continue
+      method, nums = METHODS.index(fields[0]), [int(f) for f in fields[1:]]
+      ret_val = nums.pop(1) if hist_type == 'set' else 1
+      value, start, end = nums[:3]
+      proc = nums[3] if len(nums) > 3 else NO_PROC
+      records.append(struct.pack('<QQiBBH', start, end, value, method,
+                                 ret_val != 0, proc))
+  type_name = hist_type.encode()
+  header = b'plhist\x00\x01' + struct.pack('<IIIIQ', 24, 4, len(type_name), 1,
+                                           len(records))
+  return header + type_name + b''.join(records)
+
+def check_output(output: str, expected: str, what: str):
+  expect(output.split()[:1] == [expected],
+         f'{what}: expected {expected}, got {output.strip()!r}')
+
+def check_files(polylin: str, fixtures: list, tmp: str):
+  zlib = True
+  for path, hist_type, expected in fixtures:
+    name = os.path.basename(path)
+    result = run([polylin, path])
+    if expected == 'error':
+      expect(result.returncode != 0, f'{name}: expected an error')
+      continue
+    check_output(result.stdout, expected, name)
+    check_output(run([polylin, '-i', path]).stdout, expected, f'{name} -i')
+
+    binary = os.path.join(tmp, name + '.bin')
+    with open(binary, 'wb') as out:
+      out.write(to_binary(path, hist_type))
+    check_output(run([polylin, binary]).stdout, expected, f'{name} binary')
+
+    compressed = os.path.join(tmp, name + '.gz')
+    with open(path, 'rb') as hist_file, open(compressed, 'wb') as out:
+      out.write(gzip.compress(hist_file.read()))
+    result = run([polylin, compressed])
+    zlib = zlib and 'zlib' not in result.stderr
+    if zlib:
+      check_output(result.stdout, expected, f'{name} gzip')
+
+    if hist_type in ('queue', 'pqueue'):
+      check_output(run([polylin, '--mem-limit', '1M', path]).stdout, expected,
+                   f'{name} --mem-limit')
+  if not zlib:
+    print('skipped gzip histories, built without zlib')
+
+# Histories that cannot be read report why and exit with 1, not by aborting,
+# gzip ones asking for zlib if built without it
+def check_unreadable(polylin: str, tmp: str):
+  truncated = os.path.join(tmp, 'truncated.log.gz')
+  with open(truncated, 'wb') as out:
+    out.write(gzip.compress(b'# queue\nenq 1 1 2\n' * 64)[:32])
+  for path, reason in ((os.path.join(tmp, 'missing.log'), 'Cannot open file'),
+                       (truncated, 'Truncated gzip history')):
+    result = run([polylin, path])
+    expect(result.returncode == 1 and
+           (reason in result.stderr or 'zlib' in result.stderr),
+           f'{os.path.basename(path)}: expected {reason!r}, got '
+           f'{result.returncode} {result.stderr.strip()!r}')
+
+def check_batch(polylin: str, fixtures: list, tmp: str):
+  list_file = os.path.join(tmp, 'batch.txt')
+  with open(list_file, 'w') as out:
+    out.writelines(path + '\n' for path, _, _ in fixtures)
+  rows = run([polylin, '-i', '--batch', list_file]).stdout.splitlines()[1:]
+  expect(len(rows) == len(fixtures), '--batch: a row per history')
+  for row, (path, _, expected) in zip(rows, fixtures):
+    fields = row.split('\t')
+    expect(fields[0] == path, f'--batch: rows in input order, got {fields[0]}')
+    check_output(fields[1], expected, f'{os.path.basename(path)} --batch')
+
+def check_cache(polylin: str, fixtures: list, tmp: str):
+  cache_dir = os.path.join(tmp, 'cache')
+  for path, _, expected in fixtures:
+    if expected == 'error':
+      continue
+    name = os.path.basename(path)
+    first = run([polylin, '-i', '--cache', cache_dir, path]).stdout
+    second = run([polylin, '-i', '--cache', cache_dir, path]).stdout
+    check_output(second, expected, f'{name} --cache')
+    expect(first == second, f'{name} --cache: cached result differs')
+  expect(len(os.listdir(cache_dir)) > 0, '--cache: entries stored')
+
+def check_server(polylin: str, fixtures: list, tmp: str):
+  socket_path = os.path.join(tmp, 'polylin.sock')
+  server = subprocess.Popen([polylin, '-j', '2', '--serve', socket_path],
+                            stderr=subprocess.DEVNULL)
+  for _ in range(100):
+    if os.path.exists(socket_path):
+      break
+    time.sleep(0.05)
+  env = dict(os.environ, POLYLIN_SERVER=socket_path)
+  for path, _, expected in fixtures:
+    name = os.path.basename(path)
+    result = run([polylin, '-i', path], env)
+    if expected == 'error':
+      expect(result.returncode != 0, f'{name} --serve: expected an error')
+    else:
+      check_output(result.stdout, expected, f'{name} --serve')
+  stats = run([polylin, '--server-stats'], env).stdout
+  expect('"requests": ' in stats, '--server-stats: stats of the server')
+  server.send_signal(signal.SIGINT)
+  expect(server.wait(timeout=10) == 0, '--serve: exits on SIGINT')
+
+def check_recorded(build_dir: str, tmp: str):
+  polylin = os.path.join(build_dir, 'polylin')
+  inject = os.path.join(build_dir, 'polylin_inject')
+  histories = []
+  for hist_type in ('stack', 'queue', 'pqueue', 'set', 'deque'):
+    path = os.path.join(tmp, hist_type + '.hist')
+    num_oper = '200' if hist_type == 'deque' else '2000'
+    run([os.path.join(build_dir, 'histgen'), '-b', '-n', num_oper, '-p', '4',
+         '-o', path, hist_type])
+    histories.append((hist_type, path))
+  for simulator, args in (('pq_histgen', ['2000', '2', '2']),
+                          ('set_histgen', ['2000', '4'])):
+    path = os.path.join(tmp, simulator + '.hist')
+    with open(path, 'w') as out:
+      subprocess.run([os.path.join(build_dir, simulator), '-b'] + args,
+                     stdout=out)
+    histories.append((simulator, path))
+
+  for name, path in histories:
+    check_output(run([polylin, path]).stdout, '1', f'recorded {name}')
+    broken = path + '.lost'
+    run([inject, '-k', 'lost', '-o', broken, path])
+    check_output(run([polylin, broken]).stdout, '0', f'injected {name}')
+
+def main():
+  parser = argparse.ArgumentParser(
+      'run_fixtures', './run_fixtures.py <build_dir>',
+      'checks the fixtures through every mode of polylin')
+  parser.add_argument('build_dir', help='directory of the built executables')
+  args = parser.parse_args()
+  polylin = os.path.join(args.build_dir, 'polylin')
+  fixtures = get_fixtures()
+  with tempfile.TemporaryDirectory() as tmp:
+    check_files(polylin, fixtures, tmp)
+    check_unreadable(polylin, tmp)
+    check_batch(polylin, fixtures, tmp)
+    check_cache(polylin, fixtures, tmp)
+    check_server(polylin, fixtures, tmp)
+    check_recorded(args.build_dir, tmp)
+  print(f'{len(fixtures)} fixtures, {failures} failures')
+  return 1 if failures else 0
+
+if __name__ == '__main__':
+  exit(main())